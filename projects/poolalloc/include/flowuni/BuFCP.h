@@ -15,11 +15,14 @@
 #include "dsa/DataStructure.h"
 #include "flowuni/MemSSA.h"
 #include "flowuni/LocalFCP.h"
+#include "flowuni/SummaryCache.h"
+#include "flowuni/ModuleSummary.h"
 
 #include <set>
 #include <map>
 #include <unordered_map>
 #include <queue>
+#include <mutex>
 
 
 namespace llvm {
@@ -30,7 +33,10 @@ namespace llvm {
 
     bool runOnModule(Module &M) override;
 
-    BuFCP();
+    // Independent SCCs are analyzed on 'numThreads' threads. Calls to declarations with a summary
+    // in 'summaries' instantiate it, and the summaries of the functions the module exports are
+    // added to it.
+    explicit BuFCP(unsigned numThreads = 1, ModuleSummaries *summaries = nullptr);
 
     // Map function to the number of the SCC the function belongs to.
     std::unordered_map<Function*, int> funcSccNum;
@@ -44,40 +50,130 @@ namespace llvm {
     // Data-flow analysis for each SCC.
     std::vector<LocalFCP> sccFCP;
 
-    // Map from fake Values (Values cloned from real Value for inlining) to the corresponding real value.
-    std::unordered_map<Value*, Value*> fakeValueToReal;
+    // The point-to set of 'x', a Value used in 'f'.
+    // With -flowuni-on-demand, nothing is analyzed up front: a query analyzes only the backward slice
+    // of 'x' in the DUG of the SCC of 'f', and (completely) the SCCs called from that slice. Results
+    // are kept for later queries.
+    std::unordered_set<Value*> getPointToSetForVal(Value *x, Function *f);
   private:
     EquivBUDataStructures* buDSA;
     LocalMemSSAWrapper* memSSA;
+    unsigned numThreads;
     void clear();
 
+    // SCC number of 'f', or 0 (the empty SCC) if 'f' is not in any SCC.
+    int getSccNum(Function *f) const;
+
+    // Intra-SCC points-to analysis for SCC 'i'. If 'sliceOf' is given, only the backward slice of
+    // these Values is analyzed.
+    void analyzeScc(int i, const std::vector<Value*> *sliceOf = nullptr);
+
+    // On-demand analysis. Values queried so far in each SCC that is only analyzed partially.
+    std::vector<std::vector<Value*>> sccQueries;
+    // Make the results for the Values 'xs' of SCC 'scc' available.
+    void demand(int scc, const std::vector<Value*>& xs);
+    // Analyze SCC 'scc' completely, after all SCCs it calls.
+    void solveScc(int scc);
+    // Analyze the backward slice of 'queries' in SCC 'scc', after all SCCs called from the slice.
+    void solveSlice(int scc, const std::vector<Value*>& queries);
+    // Answer the testing annotations of the module through on-demand queries.
+    void checkAssertionsOnDemand();
+
+    // Numbers of the other SCCs directly called from SCC 'scc'.
+    std::vector<int> calleeSccs(int scc);
+
+    // Results of unchanged SCCs are loaded from 'cache' instead of being recomputed.
+    SummaryCache cache;
+    std::vector<std::string> sccKey;
+    std::vector<char> loadedFromCache;
+    const std::string& computeSccKey(int scc);
+
+    // Serializes summary instantiation (which queries the shared DSGraphs) and diagnostic output.
+    std::mutex inlineLock;
+    std::mutex outputLock;
+
+    // Functions each call may call: the called function (seen through casts) for direct calls,
+    // its targets in DSA's call graph for indirect calls. Empty if unknown (e.g. inline asm).
+    std::unordered_map<CallInst*, std::vector<Function*>> calleesOf;
+    // For calls that may call declarations and return a pointer, the arguments the returned
+    // pointer may alias, according to the DSGraph of the caller.
+    std::unordered_map<CallInst*, std::vector<Value*>> declRetAliases;
+    void resolveCallees(Function*);
+    const std::vector<Function*>& getCallees(CallInst *call) const;
+    // Whether 'call' may call a declaration without summary or an unknown function.
+    bool mayCallExternal(CallInst *call) const;
+
+    // Summaries of functions defined in other modules.
+    ModuleSummaries *summaries;
+    std::unordered_map<Function*, const FunctionSummary*> importedSummaries;
+    // The summary of the declaration 'f', or nullptr.
+    const FunctionSummary* getImportedSummary(Function *f) const;
+    // Add the summaries of the functions 'M' exports to 'summaries'.
+    void exportSummaries(Module &M);
+
     void resolveInSccCalls(Function*);
     void resolveSccCallsArgCopy(int scc, LocalFCP&);
 
     std::unordered_map<Function*, std::unordered_set<ReturnInst*>> retInstOfFunc;
 
-    //
-    std::vector<bool> visited;
+    // Whether summaries have been inlined into each SCC. (Not a vector<bool>: SCCs are finished
+    // on different threads.)
+    std::vector<char> visited;
+
+    // Inline summaries of callees into SCC 'scc'. All SCCs it calls must be processed already.
     void postOrderInline(int scc);
 
+    // Number of caller SCCs that have not inlined each SCC yet. The placeholder arena of an SCC
+    // only keeps its mapping to real Values until then.
+    std::vector<int> pendingCallers;
+    void releaseCalleePlaceholders(int scc);
+
+    // Build the graphs callers of SCC 'scc' instantiate, at its returning instructions and at the
+    // last definitions of memory objects visible to callers.
+    void buildInterfaceGraphs(int scc);
+
+    // Report the size of the DUG of SCC 'scc' and the work done on it so far to the profiler,
+    // as counters prefixed by 'stage'.
+    void countProfile(int scc, const std::string& stage);
+
 
+    // Merge the summaries of all functions 'call' may call into its caller.
     void mergeCallsite(CallInst* call);
 
+    // Instantiate the summary of 'callee', a function in another SCC, at 'call'.
+    void mergeCallee(CallInst *call, Function *callee);
+
+    // Instantiate 'summary' of 'callee', a function defined in another module, at 'call'.
+    void mergeImportedCallee(CallInst *call, Function *callee, const FunctionSummary &summary);
+
+    // Values of a callee cloned into its caller at a callsite.
+    struct Cloning {
+      // Mapping from Values in the callee to cloned Values in the caller.
+      std::unordered_map<Value*, Value*> mapping;
+      const PlaceholderArena &from;
+      PlaceholderArena &to;
+
+      Cloning(const PlaceholderArena &from, PlaceholderArena &to) : from(from), to(to) {}
+    };
+
+    // Merge 'retGraph', the graph at a returning instruction of a callee, into the graph of 'call'.
+    void mergeReturnedValue(CallInst *call, const CompactPointToGraph &retGraph, Cloning &cloning);
+
     // For a CallInst ('callsite') in 'caller' to 'callee', merge the PointToGraph of
     // the 'last-definition' of 'm' in 'callee', into the PointToGraph of 'RetArgsMergePoints'
     // of 'callsite' for 'n'.
     // And recursively merge outgoing links of 'n' and 'm'
     void mergePointToGraphByDSNodes(DSNodeHandle nh, DSNodeHandle mh, Function *caller, CallInst *callsite,
                                     Function *callee,
-                                    UnionFind<DSNode *> &mergedNodes, std::unordered_map<Value*, Value*>& cloningMapping);
+                                    UnionFind<DSNode *> &mergedNodes, Cloning& cloning);
 
-    // Brute-force-ly clone every thing of 'src' into 'dest'.
-    // For any Value in 'src', a new 'fake' Value cloning is used in 'dest'.
-    // The correspondence between real Value* and fake Value* is recorded in 'fakeValueToReal'.
-    void clonePointToGraphInto(PointToGraph &dest, PointToGraph &src, std::unordered_map<Value *, Value *> &cloned,
+    // Clone the classes and links of 'src' into 'dest'.
+    // For any Value in 'src', a new placeholder cloning is used in 'dest'.
+    // The real Value each placeholder is a copy of is recorded in the caller's placeholder arena.
+    void clonePointToGraphInto(PointToGraph &dest, const CompactPointToGraph &src, Cloning &cloned,
                                    std::vector<DeltaPointToGraph> &destDelta);
 
-    Value* cloneValue(Value *k, std::unordered_map<Value *, Value *> &cloned);
+    Value* cloneValue(Value *k, Cloning &cloned);
   };
 }
 
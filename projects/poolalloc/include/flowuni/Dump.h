@@ -0,0 +1,43 @@
+//
+// Debugging dumps of the analysis: DOT graphs of memory SSA and point-to graphs, and the DSA result.
+//
+
+#ifndef POOLALLOC_DUMP_H
+#define POOLALLOC_DUMP_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+
+namespace llvm {
+
+  // Dumps are off unless -flowuni-dump is given. They are then restricted to functions whose
+  // names match -flowuni-dump-filter, and are written either as files into -flowuni-dump-dir or
+  // as entries of the single gzip-compressed tar archive -flowuni-dump-archive.
+  struct Dump {
+    // Whether anything is dumped.
+    static bool enabled();
+
+    // Whether the dumps of 'f' are wanted.
+    static bool enabledFor(const Function *f);
+
+    // Whether the dumps of an SCC are wanted, i.e. those of any of its members 'fs'.
+    template<typename Functions>
+    static bool enabledForAny(const Functions& fs) {
+      for(auto f : fs) {
+        if(enabledFor(f)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // A buffered stream for the dump 'name', or nullptr if it can not be written. An entry of
+    // the archive is added when its stream is destroyed.
+    static std::unique_ptr<raw_ostream> open(const std::string& name);
+  };
+}
+
+#endif //POOLALLOC_DUMP_H
@@ -12,6 +12,7 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/Analysis/DominanceFrontier.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/ADT/BitVector.h"
 #include "dsa/DataStructure.h"
 #include "flowuni/MemSSA.h"
 
@@ -19,6 +20,14 @@
 #include <map>
 #include <unordered_map>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <array>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <atomic>
 
 
 namespace llvm {
@@ -74,13 +83,286 @@ namespace llvm {
     }
   };
 
+  // Dense id of a resource (or placeholder) within the SCC it is analyzed in.
+  typedef uint32_t ResourceId;
+  static const ResourceId NoResource = ~0u;
+
+  // Assigns every resource/placeholder seen by an SCC a dense id, so that point-to graphs
+  // can be stored as flat arrays indexed by ResourceId instead of hash maps keyed by Value*.
+  // One numbering is shared by all the PointToGraphs of an SCC.
+  struct ResourceNumbering {
+    // Get the id of 'v', assigning a fresh one if 'v' is not numbered yet.
+    ResourceId getId(Value *v) {
+      auto ite = ids.find(v);
+      if(ite != ids.end()) {
+        return ite->second;
+      }
+      ResourceId id = values.size();
+      ids[v] = id;
+      values.push_back(v);
+      return id;
+    }
+
+    // Get the id of 'v', or NoResource if 'v' is not numbered yet.
+    ResourceId lookup(Value *v) const {
+      auto ite = ids.find(v);
+      return ite == ids.end() ? NoResource : ite->second;
+    }
+
+    Value *getValue(ResourceId id) const {
+      return id == NoResource ? nullptr : values[id];
+    }
+
+    unsigned size() const {
+      return values.size();
+    }
+
+    // Fields of a resource tracked field-sensitively, by their offset within its DSNode.
+    // The resource itself stands for the field at offset 0.
+    typedef std::vector<std::pair<unsigned, ResourceId>> FieldList;
+
+    void setFields(ResourceId id, FieldList list) {
+      fields[id] = std::move(list);
+    }
+
+    // The fields of 'id', or nullptr if it is not tracked field-sensitively.
+    const FieldList* getFields(ResourceId id) const {
+      auto ite = fields.find(id);
+      return ite == fields.end() ? nullptr : &ite->second;
+    }
+
+    bool hasFields() const {
+      return !fields.empty();
+    }
+
+  private:
+    std::unordered_map<Value*, ResourceId> ids;
+    std::vector<Value*> values;
+    std::unordered_map<ResourceId, FieldList> fields;
+  };
+
+  // Array split into fixed-size chunks that are shared between copies. A chunk is copied on
+  // the first write through a copy that does not own it exclusively, so copying the array costs
+  // one pointer per chunk and a modified copy only pays for the chunks it touched.
+  // Entries beyond size() read as 'fill'.
+  template<typename T, unsigned ChunkBits = 6>
+  class PersistentArray {
+  public:
+    static const unsigned ChunkSize = 1u << ChunkBits;
+
+    explicit PersistentArray(T fill = T()) : length(0), fill(fill) {}
+
+    unsigned size() const {
+      return length;
+    }
+
+    T get(unsigned i) const {
+      return i < length ? (*chunks[i >> ChunkBits])[i & (ChunkSize - 1)] : fill;
+    }
+
+    void set(unsigned i, T v) {
+      if(i >= length) {
+        grow(i + 1);
+      }
+      auto& chunk = chunks[i >> ChunkBits];
+      if(chunk.use_count() > 1) {
+        chunk = std::make_shared<Chunk>(*chunk);
+      }
+      (*chunk)[i & (ChunkSize - 1)] = v;
+    }
+
+    // Write 'v' only if it can be done in place, i.e. without unsharing a chunk.
+    // Used for updates which are merely a cache, like path compression.
+    void trySet(unsigned i, T v) {
+      auto& chunk = chunks[i >> ChunkBits];
+      if(chunk.use_count() == 1) {
+        (*chunk)[i & (ChunkSize - 1)] = v;
+      }
+    }
+
+    // Make entries [size(), n) explicit. They all share one 'fill'-ed chunk until written.
+    void grow(unsigned n) {
+      if(n <= length) {
+        return;
+      }
+      std::shared_ptr<Chunk> blank;
+      while(chunks.size() * ChunkSize < n) {
+        if(!blank) {
+          blank = std::make_shared<Chunk>();
+          blank->fill(fill);
+        }
+        chunks.push_back(blank);
+      }
+      length = n;
+    }
+
+  private:
+    typedef std::array<T, ChunkSize> Chunk;
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    unsigned length;
+    T fill;
+  };
+
+  // Disjoint-set over dense ids. Ids not covered by the arrays are singletons, so that
+  // a graph only grows when one of its classes is actually touched. The arrays are persistent,
+  // so copies of a DenseUnionFind share everything they have not modified since.
+  struct DenseUnionFind {
+    // Parent of each id; NoResource for roots.
+    PersistentArray<ResourceId> parent;
+    PersistentArray<uint8_t> rank;
+    // Members of each class form a circular list through 'next' (NoResource for a singleton), so
+    // that a class can be enumerated in time linear to its size.
+    PersistentArray<ResourceId> next;
+    // Number of merges so far. Leaders only change when it does.
+    unsigned numMerges;
+
+    DenseUnionFind() : parent(NoResource), rank(0), next(NoResource), numMerges(0) {}
+
+    unsigned size() const {
+      return parent.size();
+    }
+
+    bool isRoot(ResourceId x) const {
+      return parent.get(x) == NoResource;
+    }
+
+    ResourceId getParent(ResourceId x) const {
+      ResourceId p = parent.get(x);
+      return p == NoResource ? x : p;
+    }
+
+    // The member after 'x' in the circular list of its class.
+    ResourceId getNext(ResourceId x) const {
+      ResourceId n = next.get(x);
+      return n == NoResource ? x : n;
+    }
+
+    ResourceId find(ResourceId x) {
+      ResourceId root = findConst(x);
+      // Path compression, as long as it does not unshare memory with other graphs.
+      while(x != root) {
+        ResourceId next = getParent(x);
+        if(next != root) {
+          parent.trySet(x, root);
+        }
+        x = next;
+      }
+      return root;
+    }
+
+    // Same as find() but without path compression.
+    ResourceId findConst(ResourceId x) const {
+      for(ResourceId p = parent.get(x); p != NoResource; p = parent.get(x)) {
+        x = p;
+      }
+      return x;
+    }
+
+    // Return true if this requested merging is activated.
+    bool merge(ResourceId x, ResourceId y) {
+      ResourceId fx = find(x);
+      ResourceId fy = find(y);
+      if(fx == fy) {
+        return false;
+      }
+      // Splice the member lists of the two classes.
+      ResourceId nx = getNext(fx);
+      ResourceId ny = getNext(fy);
+      next.set(fx, ny);
+      next.set(fy, nx);
+
+      uint8_t rx = rank.get(fx);
+      uint8_t ry = rank.get(fy);
+      if(rx < ry) {
+        parent.set(fx, fy);
+      } else if(rx > ry) {
+        parent.set(fy, fx);
+      } else {
+        parent.set(fx, fy);
+        rank.set(fy, ry + 1);
+      }
+      // Keep 'parent' covering every id that has an entry in 'rank'.
+      parent.grow(std::max(fx, fy) + 1);
+      numMerges++;
+      return true;
+    }
+
+    int getRank(ResourceId x) {
+      return rank.get(find(x));
+    }
+
+    void setRank(ResourceId x, int r) {
+      ResourceId fx = find(x);
+      parent.grow(fx + 1);
+      rank.set(fx, r);
+    }
+
+    bool equivalent(ResourceId x, ResourceId y) {
+      return find(x) == find(y);
+    }
+  };
+
+  // Placeholders stand for memory objects without a Value of their own, e.g. locations pointed by
+  // arguments, or memory objects of a callee cloned into its callers. They are used as Values in
+  // point-to graphs, but never dereferenced.
+  //
+  // A placeholder is a tagged 64-bit id: the top bit is set (so it is never a user-space address),
+  // bits 62..32 number the arena it comes from and bits 31..0 are its index in the arena. Every
+  // arena (and every reset() of one) takes a new number, so placeholders never alias.
+  class PlaceholderArena {
+  public:
+    PlaceholderArena();
+    PlaceholderArena(const PlaceholderArena&) = delete;
+    PlaceholderArena& operator=(const PlaceholderArena&) = delete;
+    // The moved-from arena is reset(), so that it can not hand out the same ids again.
+    PlaceholderArena(PlaceholderArena&& other) noexcept;
+    PlaceholderArena& operator=(PlaceholderArena&& other) noexcept;
+
+    // A new placeholder, standing for a copy of 'real' (if given).
+    Value* fresh(Value *real = nullptr);
+
+    // The Value the placeholder 'p' stands for a copy of, or nullptr if unknown, released, or 'p'
+    // is not from this arena.
+    Value* getReal(Value *p) const;
+
+    // Forget which Values the placeholders are copies of. The placeholders themselves stay valid.
+    void release();
+
+    // Start over as a new, empty arena.
+    void reset();
+
+    // Number of placeholders handed out.
+    unsigned size() const {
+      return count;
+    }
+
+    static bool isPlaceholder(Value *v);
+    static uint32_t arenaOf(Value *v);
+    static uint32_t indexOf(Value *v);
+
+  private:
+    static std::atomic<uint32_t> nextArena;
+    uint32_t arena;
+    uint32_t count;
+    // The Value each placeholder is a copy of, by index. Entries beyond its size are nullptr.
+    std::vector<Value*> real;
+  };
+
   struct PointToGraph {
+    // Numbering of the resources in this graph, shared by the SCC this graph belongs to.
+    ResourceNumbering *numbering;
+
     // Equivalent class of resources.
-    UnionFind<Value*, std::unordered_map> eqClass;
+    DenseUnionFind eqClass;
+
+    // The unique outgoing edge for each equivalent class of resources, or NoResource.
+    // Only defined for leader ids (i.e. results of find()) in the eqClass.
+    PersistentArray<ResourceId> pointTo;
 
-    // The unique outgoing edge for each equivalent class of resources.
-    // Only defined for leader values (i.e. results of find()) in the eqClass.
-    std::unordered_map<Value*, Value*> pointTo;
+    // A member of each class whose fields stand for the fields of the class, or NoResource if
+    // that is the leader itself (or no member has fields). Only defined for leader ids. The fields
+    // at the same offset of all members of a class are kept in the same class.
+    PersistentArray<ResourceId> fieldHolder;
 
     // The memory object pointed by the value defined by this instruction.
     Value* valPointTo;
@@ -90,26 +372,67 @@ namespace llvm {
     Value* getPointTo(Value* v);
     Value* setPointTo(Value* v, Value* to);
 
+    // The field at 'offset' of the class 'v' belongs to, or 'v' if the class has no such field.
+    Value* getField(Value *v, unsigned offset);
+
     // (Recursively) merge the equivalent classes represented by 'x' and 'y'.
     bool mergeRec(Value *x, Value *y);
 
     // Equivalent to merge x with an unnamed element.
     void mergeUnnamedRec(Value *x);
 
+    // Value-level wrappers of 'eqClass'.
+    Value* find(Value *v);
+    bool equivalent(Value *x, Value *y);
+    int getRank(Value *v);
+
+    // All members of the equivalent class 'v' belongs to, including 'v' itself.
+    std::vector<Value*> getClassMembers(Value *v);
+
+    // Changes whenever two classes are merged, i.e. whenever the results of find() may change.
+    unsigned getNumMerges() const {
+      return eqClass.numMerges;
+    }
+
+    // Ids in [0, size()) may have entries in 'eqClass' or 'pointTo'; all others are singletons
+    // pointing to nothing.
+    unsigned size() const {
+      return eqClass.size();
+    }
+
+    Value* valueOf(ResourceId id) const {
+      return numbering->getValue(id);
+    }
+
     // Uninitialized memory objects point to 'unspecificiSpace'
     static Value* unspecificSpace;
 
-    // Fake pointers for placeholders. Used for memory locations pointed by arguments or globals.
-    static char* const externalPlaceholderBase;
-    static char* const externalPlaceholderTop;
-    static char* externalPlaceholderCurrent;
-    static Value* getFreshExternalPlaceholder();
+    // Whether 'v' is a placeholder (see PlaceholderArena).
     static bool isFakeValue(Value* v);
 
     // Output an Value. Escape for pesudo Value like 'unspecificSpace'.
     static std::string escape(Value* v);
 
-    PointToGraph();
+    explicit PointToGraph(ResourceNumbering *numbering = nullptr);
+  };
+
+  // A point-to graph reduced to what a caller can observe, for instantiating it at callsites.
+  // Only the classes reachable from the interface (formal arguments, globals and the returned
+  // value) are kept, and they are numbered canonically in the order they are reached.
+  struct CompactPointToGraph {
+    // Members of each class; the first member is the leader.
+    std::vector<std::vector<Value*>> members;
+    // The class pointed by each class, or -1.
+    std::vector<int> pointTo;
+    // The memory object pointed by the value defined by the instruction.
+    Value* valPointTo;
+
+    CompactPointToGraph() : valPointTo(nullptr) {}
+
+    static CompactPointToGraph build(PointToGraph& g);
+
+    // Whether 'v' is visible outside the function, i.e. a formal argument or a global.
+    static bool isInterfaceValue(Value *v);
   };
 
   struct DeltaPointToGraph {
@@ -121,28 +444,137 @@ namespace llvm {
     Value *y;
 
     DeltaPointToGraph(Type type, Value *x, Value *y);
+
+    bool operator==(const DeltaPointToGraph& other) const {
+      return type == other.type && x == other.x && y == other.y;
+    }
   };
   DeltaPointToGraph make_pointTo(Value *x, Value *y);
   DeltaPointToGraph make_merge(Value *x, Value *y);
 
+  struct DeltaPointToGraphHash {
+    size_t operator()(const DeltaPointToGraph& d) const {
+      size_t h = std::hash<Value*>()(d.x);
+      h ^= std::hash<Value*>()(d.y) + 0x9e3779b9 + (h << 6) + (h >> 2);
+      return h ^ (size_t)d.type;
+    }
+  };
+  typedef std::unordered_set<DeltaPointToGraph, DeltaPointToGraphHash> DeltaSet;
+
+  // Drop the deltas of a batch that repeat an earlier delta of the batch (merges in either order)
+  // or merge a Value with itself, keeping the order of the others. Deltas are not canonicalized
+  // by the sender's classes: users through plain def-use edges (e.g. of a LoadInst) do not share
+  // them.
+  void compactDeltas(std::vector<DeltaPointToGraph>& deltas);
+
+
+  // Dense number of a DUG node (see LocalFCP::numberDUG()).
+  typedef unsigned DUGNodeId;
+
+  // Pending DUG nodes of the chaotic iteration. Every node is pending at most once; the order in
+  // which pending nodes are visited is given by the strategy.
+  struct DUGWorklist {
+    enum Strategy {
+      FIFO,       // First in, first out. The initial order is consistent with the dominance order.
+      LIFO,       // Last in, first out.
+      RPO,        // Always visit the pending node which comes first in reverse post-order.
+      Wavefront   // Sweep the pending nodes in reverse post-order; nodes (re-)queued during a sweep
+                  // are left for the next sweep.
+    };
+
+    explicit DUGWorklist(Strategy strategy = FIFO);
+
+    // Make room for the nodes numbered 0 .. 'numNodes' - 1.
+    void resize(unsigned numNodes);
+
+    // Queue 'node' unless it is already pending. Return true if it was queued.
+    bool push(DUGNodeId node);
+    DUGNodeId pop();
+
+    bool empty() const {
+      return numPending == 0;
+    }
+    size_t size() const {
+      return numPending;
+    }
+    bool contains(DUGNodeId node) const {
+      return inList.test(node);
+    }
+
+    // Position of 'node' in the reverse post-order, used by the RPO and Wavefront strategies.
+    // Nodes without a priority are visited after all nodes with one. A pending node keeps the
+    // priority it was queued with, so priorities are set before nodes are queued.
+    void setPriority(DUGNodeId node, unsigned p) {
+      assert(!inList.test(node) && "Priority set on a pending node");
+      if(priority[node] == UINT_MAX) {
+        numPrioritized += 1;
+      }
+      priority[node] = p;
+    }
+    unsigned getPriority(DUGNodeId node) const {
+      return priority[node];
+    }
+    unsigned numPriorities() const {
+      return numPrioritized;
+    }
+
+    // Drop all nodes, pending nodes and priorities, and switch to 'newStrategy'.
+    void reset(Strategy newStrategy);
+
+    Strategy getStrategy() const {
+      return strategy;
+    }
+    static const char *getStrategyName(Strategy s);
+
+  private:
+    typedef std::pair<unsigned, DUGNodeId> PrioritizedNode;
+    typedef std::priority_queue<PrioritizedNode, std::vector<PrioritizedNode>,
+                                std::greater<PrioritizedNode>> NodeHeap;
+
+    Strategy strategy;
+    BitVector inList;
+    unsigned numPending;
+    std::vector<unsigned> priority;
+    unsigned numPrioritized;
+
+    // Pending nodes for FIFO and LIFO.
+    std::deque<DUGNodeId> queue;
+    // Pending nodes for RPO, and the current sweep of Wavefront.
+    NodeHeap heap;
+    // Nodes queued during the current sweep of Wavefront.
+    std::vector<PrioritizedNode> nextWave;
+  };
 
   struct BuFCP;
+  struct SummaryCache;
   struct LocalFCP {
     friend struct LocalFCPWrapper;
     friend struct BuFCP;
+    friend struct SummaryCache;
 
     bool runOnFunction(Function &F, LocalMemSSA*);
 
+    // Whether fields of local stack objects are told apart (-flowuni-field-sensitive).
+    static bool isFieldSensitive();
+
     // Get (a element of) the resource equivalent class pointed by 'x' if exists.
     // Return nullptr otherwise.
     Value *getMemObjectsForVal(Value *x);
 
     std::unordered_set<Value*> getPointToSetForVal(Value *x);
 
+    // The DUGNode whose data-flow result 'x' reads, if exists. Return nullptr otherwise.
+    Instruction *getDUGNodeForVal(Value *x);
+
     // Resources considered in this phase.
     std::unordered_set<Value*> resources;
 
+    // Dense numbering of resources shared by all the PointToGraphs below.
+    std::shared_ptr<ResourceNumbering> numbering;
+
     // Map each pointer-involved instruction to its corresponding 'partial' point-to graph.
+    // dataOut[i] is a copy of dataIn[i] with dataOutInDiff[i] applied; being persistent, the two
+    // graphs share all storage not touched by the diff.
     std::unordered_map<Instruction*, PointToGraph> dataIn;
     std::unordered_map<Instruction*, PointToGraph> dataOut;
 
@@ -166,9 +598,21 @@ namespace llvm {
     // Arguments, globals, and memory objects pointed by arguments and globals.
     std::unordered_set<Value*> externalResources;
 
+    // The object each field resource belongs to (only with -flowuni-field-sensitive).
+    std::unordered_map<Value*, AllocaInst*> fieldBase;
+
+    // Placeholders created while analyzing this function (or SCC), including the ones cloned from
+    // callees.
+    PlaceholderArena placeholders;
+
     // The 'PointToGraph' for all variables at the returning point.
     PointToGraph summary;
 
+    // Compact point-to graphs at the instructions whose graphs are instantiated in callers,
+    // i.e. returning instructions and last definitions of memory objects visible to callers.
+    std::unordered_map<Instruction*, CompactPointToGraph> interfaceGraphs;
+    void buildInterfaceGraphs(const std::vector<Instruction*>& insts);
+
     // Dump the point-to graph as a DOT file.
     void dump(std::string fileName);
 
@@ -184,6 +628,11 @@ namespace llvm {
     int numCallRetFakePhi;
 
     int numEdges;
+    int numNodesBeforeSimplify;
+    int numEdgesBeforeSimplify;
+    int numPassThroughRemoved;
+    int numFakePhiRemoved;
+    int numNodeVisits;
     int numMsgPassed;
     int numMsgPassedForGlobals;
     void countStats();
@@ -192,41 +641,108 @@ namespace llvm {
     std::unordered_map<Instruction*, Value*> setInstArg;
     std::unordered_map<Instruction*, DSNode*> fakePhiSource;
 
-    std::queue<Instruction*> worklist;
-    std::unordered_set<Instruction*> inList;
+    // Values whose DUGNodes were removed by simplifyDUG(), mapped to the Value they pass through.
+    std::unordered_map<Value*, Value*> passThrough;
+
+    DUGWorklist worklist;
 
     std::unordered_map<Instruction*, std::vector<DeltaPointToGraph>> dataOutDelta;
 
-    // The difference between the output data and the input data for a DUGNode.
+    // The difference between the output data and the input data for a DUGNode. Deltas are
+    // recorded with the leaders of their classes in dataIn. 'emittedDiff' indexes them by these
+    // leaders, as of 'numMerges' merges in dataIn; it is re-canonicalized after further merges.
     std::unordered_map<Instruction*, std::vector<DeltaPointToGraph>> dataOutInDiff;
+    struct EmittedDeltas {
+      DeltaSet deltas;
+      unsigned numMerges;
+    };
+    std::unordered_map<DUGNodeId, EmittedDeltas> emittedDiff;
+
+    // The DUG as chaos-iterating walks it, fixed once the DUG is built and simplified.
+    // Node i is dugNodes[i]. Its users are userTargets[userBegin[i] .. userBegin[i + 1]) and the
+    // nodes whose deltas it applies are defSources[defBegin[i] .. defBegin[i + 1]). The per-node
+    // state points into the maps above: elements of unordered_maps never move.
+    std::vector<Instruction*> dugNodes;
+    std::unordered_map<Instruction*, DUGNodeId> dugNodeIds;
+    std::vector<unsigned> userBegin;
+    std::vector<DUGNodeId> userTargets;
+    std::vector<unsigned> defBegin;
+    std::vector<DUGNodeId> defSources;
+    std::vector<PointToGraph*> nodeIn;
+    std::vector<std::vector<DeltaPointToGraph>*> nodeOutDelta;
+    std::vector<std::vector<DeltaPointToGraph>*> nodeOutInDiff;
+    // Whether a node is the fake PHINode for globals (only counted in the stats).
+    BitVector nodeForGlobals;
+    // When each node was last visited, counting visits from 1 (0 for never). A user whose last
+    // visit precedes that of a node has not applied the last deltas of the node yet.
+    std::vector<unsigned> lastVisit;
+    unsigned visitClock;
+
+    // Number the DUGNodes and build the arrays above. Called after simplifyDUG().
+    void numberDUG();
+
+    // Whether all users of 'node' were visited after its visit numbered 'visit'.
+    bool usersVisitedSince(DUGNodeId node, unsigned visit) const;
+
+    // Queue the DUGNode 'inst', or all users of 'inst'.
+    void pushNode(Instruction *inst) {
+      worklist.push(dugNodeIds.at(inst));
+    }
+    void pushUsers(Instruction *inst);
 
     // Clear between function
     void clear();
 
-    // Check whether 'd' has already been emmited/applied to the input data of 'i'
-    bool isEmitted(const DeltaPointToGraph& d, Instruction* i);
+    // Check whether 'd' has already been emmited/applied to the input data of 'node'
+    bool isEmitted(const DeltaPointToGraph& d, DUGNodeId node);
 
     // Push all DUGNodes to the worklist in an order consistent with the dominance order.
     // (If 'a' dominates 'b', then 'a' precedes 'b' in the initial worklist)
+    // Also give the DUGNodes of 'F' their reverse post-order priorities.
     void initWorkListDomOrder(Function& F, LocalMemSSA*);
     void initWorkListDomOrder(LocalMemSSA*, BasicBlock *bb, std::unordered_set<BasicBlock*>& visited);
+    void assignWorkListPriorities(Function& F, LocalMemSSA*);
 
     // Check testing annotations in the code.
     void checkAssertions();
+    static bool isTestingAnnotation(CallInst *call);
 
     // Identify resources not created by instructions, i.e. arguments & global variables.
     void identifyResources(Function& F);
 
     // Identify instructions should be considered in the data-flow analysis
     void identifyDUGNodes(Function& F, LocalMemSSA*);
+
+    // With -flowuni-field-sensitive, create a resource for each field of the allocas whose DSNodes
+    // keep their fields apart (see LocalMemSSA::fieldSensitive).
+    void identifyFields(Function& F, LocalMemSSA*);
+
+    // The resource (equivalent class) accessed through the pointer 'ptr' by the load/store 'inst',
+    // i.e. the field of the object pointed by 'ptr' at the offset DSA gives to 'ptr'.
+    Value *getMemLocation(PointToGraph& in, Value *ptr, Instruction *inst);
+
+    // Whether stores to 'loc' may overwrite it, i.e. it is a single memory object.
+    bool isStrongUpdatable(PointToGraph& in, Value *loc);
     void identifyDUGEdges();
 
-    // Removing unnecessary nodes in the DUG. (NOT implemented yet)
+    // Removing unnecessary nodes in the DUG.
     void simplifyDUG();
 
+    // The Value 'inst' passes through unchanged, if 'inst' can be removed from the DUG.
+    Value *getPassThroughSource(Instruction *inst);
+
     // Iteratively apply the transform functions of the nodes in the DUG.
     void chaosIterating();
 
+    // When 'sliced', chaos-iterating only visits the DUGNodes in 'slice', the backward slice of
+    // some queried nodes. (Only results of nodes in the slice are valid then.)
+    bool sliced;
+    std::unordered_set<Instruction*> slice;
+    void restrictToSlice(const std::vector<Instruction*>& seeds);
+    bool inSlice(Instruction *inst) const {
+      return !sliced || slice.count(inst) > 0;
+    }
+
     // Apply dataOutInDiff to dataIn to compute dataOut.
     void computeDataOut();
 
@@ -234,8 +750,7 @@ namespace llvm {
     Value *getImplicitArgOf(Value *x);
 
     // Generate summary at returning points.
-    // TODO: 1. normalize equivalence relation for efficient merging.
-    //       2. filter out unreachable equivalent classes.
+    // (Callers instantiate the normalized and pruned 'interfaceGraphs' instead.)
     void generateSummary();
   };
 
@@ -15,14 +15,23 @@
 #include "llvm/IR/Dominators.h"
 #include "dsa/DataStructure.h"
 
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace llvm {
 
   struct LocalMemSSA {
     friend struct LocalMemSSAWrapper;
 
+    LocalMemSSA() = default;
+    // It owns its fake PHINodes, so it is moved around but never copied.
+    LocalMemSSA(const LocalMemSSA&) = delete;
+    LocalMemSSA& operator=(const LocalMemSSA&) = delete;
+    LocalMemSSA(LocalMemSSA&&) = default;
+    LocalMemSSA& operator=(LocalMemSSA&&) = default;
+
     bool runOnFunction(Function &F);
 
     // Maps each StoreInst/CallInst to its users
@@ -56,6 +65,19 @@ namespace llvm {
     std::unordered_map<CallInst*, std::unordered_map<DSNode*, PHINode*>> callRetMemMergePoints;
     std::unordered_map<CallInst*, std::unordered_map<DSNode*, Instruction*>> callArgLastDef;
 
+    // DSNodes whose fields can be told apart by their offsets: nodes of allocas only (all starting
+    // at offset 0), neither collapsed nor reachable from arguments, globals, the returned pointer or
+    // any callsite. Offsets of other nodes are not comparable to those of the callers' or callees'
+    // DSGraphs the summaries are instantiated in.
+    std::unordered_set<DSNode*> fieldSensitive;
+
+    // The offset of the field 'ptr' points to, if its DSNode is in 'fieldSensitive'. Return 0 otherwise.
+    unsigned getFieldOffset(Value *ptr);
+
+    // Offsets (other than 0) of the fields of 'alloca' which may hold pointers, i.e. the links of
+    // its DSNode, if the DSNode is in 'fieldSensitive'.
+    std::vector<unsigned> getFieldOffsets(AllocaInst *alloca);
+
     // Dump the memory SSA results as a DOT graph file
     void dump();
 
@@ -98,15 +120,24 @@ namespace llvm {
     // Corresponding DSNodes of 'resources'
     std::unordered_set<DSNode*> memObjects;
 
+    // Storage of all fake PHINodes of the function. They are never inserted into the function
+    // (except while dumping), and are all released together with the LocalMemSSA.
+    std::vector<std::unique_ptr<PHINode>> fakePhis;
+    PHINode* createFakePhi();
+
     // Information of required passes.
     DataStructures *dsa;
-    DominanceFrontier *domFrontiers;
     DominatorTree *domTree;
     DSGraph *dsgraph;
     Function *func;
 
     void buildSSARenaming(std::map<DSNode *, std::vector<Instruction *>> &def, BasicBlock *bb);
     bool aliasResource(Value *v);
+    void identifyFieldSensitiveNodes(Function &F);
+
+    // DSNode-s reachable from each DSNode, memoized.
+    std::unordered_map<DSNode*, std::vector<DSNode*>> reachableCache;
+    const std::vector<DSNode*>& reachableDSNodes(DSNode *n);
 
     // Insert fake PhiNodes into the function for debugging usage.
     void showPhiNodes();
@@ -124,9 +155,6 @@ namespace llvm {
     bool runOnModule(Module &M) override;
 
     std::unordered_map<const Function*, LocalMemSSA> ssa;
-
-  private:
-    LocalMemSSA localMemSSA;
   };
 }
 
@@ -0,0 +1,89 @@
+//
+// Summaries of the functions exported by the modules of a project, so that the modules can be
+// analyzed one at a time.
+//
+
+#ifndef POOLALLOC_MODULESUMMARY_H
+#define POOLALLOC_MODULESUMMARY_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "flowuni/LocalFCP.h"
+#include "flowuni/SummaryText.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm {
+
+  // What callers instantiate of a function defined in another module, resolved against the
+  // declaration of the function in the callers' module (see BuFCP::mergeImportedCallee).
+  struct FunctionSummary {
+    // A memory object visible to callers, and the graph at its last definition in the function.
+    struct MemObject {
+      MemObjectPath path;
+      CompactPointToGraph graph;
+    };
+    std::vector<MemObject> memObjects;
+
+    // The graphs at the returning instructions.
+    std::vector<CompactPointToGraph> rets;
+
+    // Values of the function its callers can not name (e.g. its instructions) are placeholders.
+    PlaceholderArena placeholders;
+  };
+
+  // Summaries of the externally visible functions of the modules analyzed so far, by function
+  // name. They are kept in a form independent of any module: arguments by their position, globals
+  // by name and memory objects by the links leading to them from an argument or the returned
+  // pointer. A summary is resolved against the module of its callers when it is looked up.
+  //
+  //   function <name>
+  //   <text of a SummaryWriter>   with the graphs "ret", at a returning instruction, and
+  //                               "mem <path>", at the last definition of the memory object at
+  //                               the MemObjectPath <path>
+  //   endfunction
+  struct ModuleSummaries {
+    // Serializes the summary of one function.
+    class Writer {
+    public:
+      explicit Writer(Function *f);
+      void addRet(const CompactPointToGraph& g);
+      void addMemObject(const MemObjectPath& path, const CompactPointToGraph& g);
+      std::string str() const;
+
+    private:
+      SummaryWriter writer;
+    };
+
+    // Add (or replace) the summary 'text' (from a Writer) of the function 'name'.
+    void add(const std::string& name, std::string text);
+
+    bool contains(const std::string& name) const {
+      return texts.count(name) > 0;
+    }
+
+    // A hash of the summary of 'name', which changes whenever the summary does.
+    std::string getKey(const std::string& name) const;
+
+    // The summary of the function 'decl' declares, resolved against the module of 'decl', or
+    // nullptr if there is none (or it is corrupted). Resolved summaries are kept until
+    // forgetResolved(), which must be called before the module is destroyed.
+    const FunctionSummary* lookup(Function *decl);
+    void forgetResolved();
+
+    // Write the summaries of 'names' to 'path', or read all summaries of 'path'.
+    bool write(const std::string& path, const std::vector<std::string>& names) const;
+    bool read(const std::string& path);
+
+  private:
+    std::unordered_map<std::string, std::string> texts;
+    std::unordered_map<Function*, std::unique_ptr<FunctionSummary>> resolved;
+
+    static std::unique_ptr<FunctionSummary> resolve(Function *decl, const std::string& text);
+  };
+}
+
+#endif //POOLALLOC_MODULESUMMARY_H
@@ -0,0 +1,111 @@
+//
+// Timing and counters of the phases of the FlowUni pipeline, per SCC and for the module.
+//
+
+#ifndef POOLALLOC_PROFILE_H
+#define POOLALLOC_PROFILE_H
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llvm {
+
+  // Records how long each phase takes (e.g. building memory SSA, chaos-iterating an SCC or
+  // inlining its callees) and counters attached to SCCs (e.g. messages passed). Nothing is
+  // recorded unless enabled, e.g. by leakplug's -flowuni-profile; phases then cost two clock
+  // reads and one locked push each.
+  //
+  // Results are written as JSON (totals per phase, per SCC and for the module) and in the Chrome
+  // trace-event format (every phase, on the thread it ran on), for chrome://tracing or Perfetto.
+  struct Profiler {
+    // The module-level "SCC".
+    static const int Module = -1;
+
+    static Profiler& get();
+
+    void enable() {
+      enabled = true;
+    }
+
+    bool isEnabled() const {
+      return enabled;
+    }
+
+    // Times a phase of 'scc' from construction to destruction. 'detail' tells phases of the same
+    // kind apart, e.g. the function whose memory SSA is built.
+    struct Scope {
+      Scope(const char *phase, int scc = Module, const std::string& detail = "");
+      ~Scope();
+
+    private:
+      const char *phase;
+      int scc;
+      std::string detail;
+      int64_t start;
+    };
+
+    // Start or end a module-level phase that can not be scoped, e.g. a range of passes.
+    void begin(const char *phase);
+    void end(const char *phase);
+
+    // Add 'n' to the counter 'name' of 'scc'.
+    void count(const std::string& name, int64_t n, int scc = Module);
+
+    // Name SCC 'scc' in the outputs, e.g. by its members.
+    void nameScc(int scc, const std::string& name);
+
+    void writeJSON(raw_ostream& os);
+    void writeChromeTrace(raw_ostream& os);
+
+  private:
+    struct Event {
+      const char *phase;
+      int scc;
+      std::string detail;
+      // Microseconds since 'origin'.
+      int64_t start;
+      int64_t duration;
+      unsigned thread;
+    };
+
+    Profiler();
+    int64_t now() const;
+    void record(const char *phase, int scc, const std::string& detail, int64_t start);
+
+    std::atomic<bool> enabled;
+    std::chrono::steady_clock::time_point origin;
+
+    std::mutex lock;
+    std::vector<Event> events;
+    std::map<int, std::map<std::string, int64_t>> counters;
+    std::map<int, std::string> sccNames;
+    std::map<std::string, int64_t> openPhases;
+    // Small, stable numbers for the threads phases ran on.
+    std::map<std::thread::id, unsigned> threads;
+  };
+
+  // Marks the beginning or the end of a module-level phase in a pass pipeline, e.g. around the
+  // DSA passes.
+  struct ProfileMarker : public ModulePass {
+    static char ID;
+    explicit ProfileMarker(const char *phase = "", bool begin = true);
+    void getAnalysisUsage(AnalysisUsage &AU) const override;
+    bool runOnModule(Module &M) override;
+
+  private:
+    const char *phase;
+    bool isBegin;
+  };
+}
+
+#endif //POOLALLOC_PROFILE_H
@@ -0,0 +1,67 @@
+//
+// On-disk cache of the bottom-up results of SCCs, so that unchanged SCCs are not re-analyzed.
+//
+
+#ifndef POOLALLOC_SUMMARYCACHE_H
+#define POOLALLOC_SUMMARYCACHE_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "dsa/DataStructure.h"
+#include "flowuni/MemSSA.h"
+#include "flowuni/LocalFCP.h"
+#include "flowuni/SummaryText.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace llvm {
+
+  // Stores, for an SCC after inlining its callees, everything its callers read when the SCC's
+  // summaries are instantiated at a callsite (see BuFCP::mergeCallsite):
+  //   - the point-to graph at every returning instruction,
+  //   - the point-to graph at the last definition of every memory object reachable from formal
+  //     arguments or returned values,
+  //   - the summary.
+  //
+  // An entry is keyed by a hash of the IR of the SCC's members (and the globals they use) and the
+  // keys of all SCCs they call, so an SCC is re-analyzed iff it or one of its transitive callees
+  // changed.
+  //
+  // Entries are written by a SummaryWriter, naming Values relative to the module: globals by name,
+  // arguments and instructions by their position in their function. Placeholders are renamed into
+  // fresh ones when loaded. Memory objects are named by their MemObjectPath, i.e. the same walk
+  // mergeCallsite does.
+  struct SummaryCache {
+    // An empty 'dir' disables the cache.
+    explicit SummaryCache(std::string dir = "");
+
+    bool enabled() const {
+      return !dir.empty();
+    }
+
+    static std::string computeKey(const std::unordered_set<Function*>& members,
+                                  const std::vector<std::string>& calleeKeys);
+
+    // Restore the entry 'key' into 'fcp'. Return false if there is no (valid) entry.
+    bool load(const std::string& key, const std::unordered_set<Function*>& members,
+              DataStructures *dsa, LocalMemSSAWrapper *memSSA, LocalFCP& fcp);
+
+    // Write 'fcp' as the entry 'key'. Return false if the SCC can not be cached.
+    bool store(const std::string& key, const std::unordered_set<Function*>& members,
+               DataStructures *dsa, LocalMemSSAWrapper *memSSA, const LocalFCP& fcp);
+
+  private:
+    std::string dir;
+
+    std::string entryPath(const std::string& key) const;
+
+    // The DSNode of 'f' at 'path' in 'dsg' (LocalMemSSA::GlobalsLeader for global nodes), or
+    // nullptr if there is none.
+    static DSNode* resolveMemObject(Function *f, DSGraph *dsg, const MemObjectPath& path);
+  };
+}
+
+#endif //POOLALLOC_SUMMARYCACHE_H
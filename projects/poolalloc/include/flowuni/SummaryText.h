@@ -0,0 +1,133 @@
+//
+// The text form of point-to graphs shared by the summary cache and the module summaries.
+//
+
+#ifndef POOLALLOC_SUMMARYTEXT_H
+#define POOLALLOC_SUMMARYTEXT_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "dsa/DSGraph.h"
+#include "flowuni/LocalFCP.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace llvm {
+
+  // A memory object reached from the interface of a function by following DSGraph links. It is
+  // written "a<argNo>", "r" (the returned pointer) or "G" (all the memory objects of globals),
+  // followed by ".<offset>" for each link, e.g. "a0.8" is the object pointed by offset 8 of the
+  // one the first argument points to.
+  //
+  // Offsets are relative to the handle a link leaves (as in BuFCP::mergePointToGraphByDSNodes),
+  // so that callers can follow them from their own handles, whose offsets may differ.
+  struct MemObjectPath {
+    enum Root {
+      Argument,   // Reached from the 'argNo'-th argument
+      Returned,   // Reached from the returned pointer
+      Globals     // All the memory objects reachable from globals
+    } root;
+    unsigned argNo;
+    std::vector<int> offsets;
+
+    MemObjectPath() : root(Argument), argNo(0) {}
+
+    std::string str() const;
+    static bool parse(StringRef s, MemObjectPath& path);
+
+    // Follow the offsets from 'h'. The result has no node if a link is missing.
+    DSNodeHandle follow(DSNodeHandle h) const;
+
+    // Visit the memory objects reachable from the arguments and the returned pointer of 'f' in
+    // 'dsg', breadth-first, each once with the first path found to it. Global nodes are visited
+    // once, as LocalMemSSA::GlobalsLeader with the path "G".
+    static void forEach(Function *f, DSGraph *dsg,
+                        const std::function<void(DSNode*, const MemObjectPath&)>& visit);
+  };
+
+  // Writes a table of Values followed by graphs over them:
+  //   values <n>     followed by n lines "u", "f", "g <global>", "a <argNo> <function>" or
+  //                  "i <position> <function>"
+  //   <header>       a line naming the graph for its reader, followed by the lines
+  //                  "c <value>..." (a class, leader first), "p <class> <class>", "v <value>",
+  //                  "s <value>" and "end"
+  class SummaryWriter {
+  public:
+    // With a 'scope', only Values visible to the callers of 'scope' are named and all others are
+    // written as placeholders. Otherwise all Values are named relative to the module.
+    explicit SummaryWriter(Function *scope = nullptr);
+
+    void addGraph(const std::string& header, const CompactPointToGraph& g);
+    void addGraph(const std::string& header, const PointToGraph& g);
+
+    // The index of 'v' in the table, for headers naming a Value.
+    unsigned get(Value *v);
+
+    // Whether a Value could not be named, e.g. a fake phi which is not in any function.
+    bool failed() const {
+      return fail;
+    }
+
+    std::string str() const;
+
+  private:
+    Function *scope;
+    std::vector<std::string> table;
+    std::unordered_map<Value*, unsigned> index;
+    std::unordered_map<Function*, std::unordered_map<Instruction*, unsigned>> positions;
+    std::string graphs;
+    bool fail;
+
+    void writeGraph(const CompactPointToGraph& g, const std::unordered_set<Value*>& sets);
+  };
+
+  // Reads the text of a SummaryWriter back, resolving it against the module 'M'.
+  class SummaryReader {
+  public:
+    SummaryReader(StringRef text, Module *M);
+
+    // Read the table. Placeholders are renamed into fresh ones of 'placeholders'; Values 'M' does
+    // not have are left nullptr in 'values'.
+    bool readValues(PlaceholderArena& placeholders);
+    std::vector<Value*> values;
+
+    // Read the header of the next graph. Return false at the end of the text.
+    bool nextHeader(StringRef& header);
+
+    // Read the graph following its header.
+    bool readGraph(CompactPointToGraph& g);
+    bool readGraph(PointToGraph& g);
+
+    // The Value at 'index' in the table, or nullptr if there is none.
+    Value* getValue(StringRef index) const;
+
+    // Reject empty strings, signs and overflows.
+    static bool parseUnsigned(StringRef s, unsigned& n);
+
+  private:
+    StringRef text;
+    Module *M;
+
+    bool nextLine(StringRef& line);
+    bool readGraph(CompactPointToGraph& g, std::vector<Value*>& sets);
+  };
+
+  // A hash of 'text', as 32 hex digits.
+  std::string hashSummaryText(StringRef text);
+
+  // Write 'text' to 'path' through a temporary file, so that a concurrent reader never sees it
+  // partially written.
+  bool writeSummaryFile(const std::string& path, StringRef text);
+
+  // The contents of 'path', or nullptr if it can not be read.
+  std::unique_ptr<MemoryBuffer> readSummaryFile(const std::string& path);
+}
+
+#endif //POOLALLOC_SUMMARYTEXT_H
@@ -0,0 +1,43 @@
+//
+// A small scheduler for a DAG of tasks, used to analyze independent SCCs concurrently.
+//
+
+#ifndef POOLALLOC_TASKGRAPH_H
+#define POOLALLOC_TASKGRAPH_H
+
+#include <functional>
+#include <vector>
+
+namespace llvm {
+
+  // Runs a DAG of tasks on a pool of threads. A task is started only after all the tasks it
+  // depends on have finished. With a single thread, tasks are run on the calling thread in a
+  // deterministic topological order: ready tasks are started in the order they were added.
+  struct TaskGraph {
+    typedef unsigned TaskId;
+
+    TaskId addTask(std::function<void()> fn);
+
+    // 'task' can not start before 'dependency' is finished.
+    void addDependency(TaskId task, TaskId dependency);
+
+    // Run all tasks and return when all of them are finished. The graph must be acyclic.
+    void run(unsigned numThreads);
+
+    unsigned size() const {
+      return tasks.size();
+    }
+
+  private:
+    struct Task {
+      std::function<void()> fn;
+      std::vector<TaskId> dependents;
+      unsigned numDependencies;
+
+      Task(std::function<void()> fn) : fn(fn), numDependencies(0) {}
+    };
+    std::vector<Task> tasks;
+  };
+}
+
+#endif //POOLALLOC_TASKGRAPH_H
@@ -6,8 +6,15 @@
 #include "flowuni/MemSSA.h"
 #include "flowuni/LocalFCP.h"
 #include "flowuni/BuFCP.h"
+#include "flowuni/TaskGraph.h"
+#include "flowuni/Profile.h"
+#include "flowuni/Dump.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/CommandLine.h"
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
 #include <llvm/IR/InstIterator.h>
 
 using namespace llvm;
@@ -15,11 +22,20 @@ using namespace llvm;
 
 namespace{
   static RegisterPass<BuFCP> X("flowuni-bu", "Flow-sensitive unification based points-to analysis", true, true);
+
+  static cl::opt<std::string> SummaryCacheDir("flowuni-cache-dir",
+    cl::desc("Directory for caching analysis results of SCCs between runs (disabled if empty)"),
+    cl::value_desc("directory"), cl::init(""));
+
+  static cl::opt<bool> OnDemand("flowuni-on-demand",
+    cl::desc("Analyze SCCs only when their results are queried"),
+    cl::init(false));
 }
 
 char BuFCP::ID = 0;
 
-BuFCP::BuFCP() : ModulePass(ID) {
+BuFCP::BuFCP(unsigned numThreads, ModuleSummaries *summaries)
+  : ModulePass(ID), numThreads(numThreads), summaries(summaries) {
 
 }
 
@@ -35,17 +51,32 @@ void BuFCP::clear() {
   sccMember.clear();
   sccFCP.clear();
   retInstOfFunc.clear();
-  fakeValueToReal.clear();
+  calleesOf.clear();
+  declRetAliases.clear();
+  importedSummaries.clear();
+  pendingCallers.clear();
   sccCount = 1;  // SCC #0 is left as empty for debugging.
-  sccFCP.push_back(LocalFCP());
   sccMember.push_back(std::unordered_set<Function*>());
+  sccKey.clear();
+  loadedFromCache.clear();
+  sccQueries.clear();
+  cache = SummaryCache(SummaryCacheDir);
+}
+
+int BuFCP::getSccNum(Function *f) const {
+  auto ite = funcSccNum.find(f);
+  return ite == funcSccNum.end() ? 0 : ite->second;
 }
 
 bool BuFCP::runOnModule(Module &M) {
   clear();
 
   buDSA = &getAnalysis<EquivBUDataStructures>();
-  buDSA->print(errs(), &M);
+  if(Dump::enabled()) {
+    if(std::unique_ptr<raw_ostream> os = Dump::open("dsa.txt")) {
+      buDSA->print(*os, &M);
+    }
+  }
 
   memSSA = &getAnalysis<LocalMemSSAWrapper>();
 
@@ -70,81 +101,382 @@ bool BuFCP::runOnModule(Module &M) {
     sccCount += 1;
   }
 
+  Profiler& profiler = Profiler::get();
+  if(profiler.isEnabled()) {
+    for(int i = 0; i < sccCount; i++) {
+      std::string name;
+      for(auto f : sccMember[i]) {
+        name += (name.empty() ? "" : ",") + f->getName().str();
+      }
+      profiler.nameScc(i, name);
+    }
+  }
+
+  // Summaries of functions defined in other modules are resolved up front: they are only looked
+  // up while SCCs are analyzed on several threads.
+  if(summaries != nullptr) {
+    for(Function& F : M) {
+      if(F.isDeclaration() && summaries->contains(F.getName())) {
+        if(const FunctionSummary *summary = summaries->lookup(&F)) {
+          importedSummaries[&F] = summary;
+        }
+      }
+    }
+  }
+
   // Step2. Build SCC-level CFG and memory SSA.
+  {
+    Profiler::Scope profile("resolve-calls");
+    for(int i = 0; i < sccCount; i++) {
+      auto& scc = sccMember[i];
+      for(auto func : scc) {
+        resolveCallees(func);
+        resolveInSccCalls(func);
+        memSSA->ssa[func].dump();
+      }
+    }
+  }
+
+  // Keys of SCCs for the summary cache. A key covers the SCC and all its transitive callees.
+  sccKey = std::vector<std::string>(sccCount);
+  loadedFromCache = std::vector<char>(sccCount, false);
+  if(cache.enabled()) {
+    for(int i = 1; i < sccCount; i++) {
+      computeSccKey(i);
+    }
+  }
+
+  sccFCP.resize(sccCount);
+  visited = std::vector<char>(sccCount, false);
+  sccQueries = std::vector<std::vector<Value*>>(sccCount);
+
+  std::vector<std::vector<int>> callees(sccCount);
+  pendingCallers = std::vector<int>(sccCount, 0);
   for(int i = 0; i < sccCount; i++) {
-    auto& scc = sccMember[i];
-    for(auto func : scc) {
-      resolveInSccCalls(func);
-      memSSA->ssa[func].dump();
+    callees[i] = calleeSccs(i);
+    for(int callee : callees[i]) {
+      pendingCallers[callee] += 1;
     }
   }
 
-  // Step3. Perform intra-SCC points-to analysis
+  if(OnDemand) {
+    // Nothing more is analyzed until it is queried.
+    checkAssertionsOnDemand();
+    return false;
+  }
+
+  // Step3. Perform intra-SCC points-to analysis. SCCs are independent of each other at this step.
+  TaskGraph localTasks;
+  for(int i = 0; i < sccCount; i++) {
+    localTasks.addTask([this, i]() { analyzeScc(i); });
+  }
+  {
+    Profiler::Scope profile("local-stage");
+    localTasks.run(numThreads);
+  }
+
+  errs() << "\n\nBU-stage: \n";
+
+  // Step4. Post-order inline function summary: an SCC is processed after all SCCs it calls.
+  TaskGraph inlineTasks;
+  for(int i = 0; i < sccCount; i++) {
+    inlineTasks.addTask([this, i]() { postOrderInline(i); });
+  }
+  for(int i = 0; i < sccCount; i++) {
+    for(int callee : callees[i]) {
+      inlineTasks.addDependency(i, callee);
+    }
+  }
+  {
+    Profiler::Scope profile("bu-stage");
+    inlineTasks.run(numThreads);
+  }
+
   for(int i = 0; i < sccCount; i++) {
     errs() << "\nSCC " << i << "\n";
+    errs() << "Member: ";
+    for(auto f : sccMember[i]) {
+      errs() << f->getName() << ", ";
+    }
+    errs() << "\n";
 
-    sccFCP.push_back(LocalFCP());
-    LocalFCP &fcp = sccFCP[i];
-    auto &members = sccMember[i];
+    if(loadedFromCache[i]) {
+      errs() << "Loaded from the summary cache\n";
+      continue;
+    }
+    sccFCP[i].checkAssertions();
+    sccFCP[i].countStats();
+  }
 
+  if(summaries != nullptr) {
+    Profiler::Scope profile("export-summaries");
+    exportSummaries(M);
+  }
+  return false;
+}
+
+void BuFCP::analyzeScc(int i, const std::vector<Value*> *sliceOf) {
+  LocalFCP &fcp = sccFCP[i];
+  auto &members = sccMember[i];
+
+  {
+    std::lock_guard<std::mutex> guard(outputLock);
+    errs() << "\nSCC " << i << "\n";
     errs() << "Member: ";
     for(auto f : members) {
       errs() << f->getName() << ", ";
     }
     errs() << "\n";
+  }
 
+  if(cache.enabled() && members.size() > 0 && sliceOf == nullptr) {
+    // Loading resolves memory objects in the shared DSGraphs.
+    std::lock_guard<std::mutex> guard(inlineLock);
+    Profiler::Scope profile("cache-load", i);
+    if(cache.load(sccKey[i], members, buDSA, memSSA, fcp)) {
+      loadedFromCache[i] = true;
+      buildInterfaceGraphs(i);
+      return;
+    }
+  }
+
+  {
+    Profiler::Scope profile("dug", i);
     fcp.clear();
     for(auto f : members) {
       fcp.identifyResources(*f);
-      fcp.identifyDUGNodes(*f, &memSSA->ssa[f]);
+      fcp.identifyDUGNodes(*f, &memSSA->ssa.at(f));
+      fcp.identifyFields(*f, &memSSA->ssa.at(f));
     }
     fcp.identifyDUGEdges();
     resolveSccCallsArgCopy(i, fcp);
     fcp.simplifyDUG();
+    fcp.numberDUG();
+    if(sliceOf != nullptr) {
+      std::vector<Instruction*> seeds;
+      for(Value *x : *sliceOf) {
+        if(Instruction *node = fcp.getDUGNodeForVal(x)) {
+          seeds.push_back(node);
+        }
+      }
+      fcp.restrictToSlice(seeds);
+    }
+  }
+  {
+    Profiler::Scope profile("chaos-iteration", i);
     for(auto f : members) {
-      fcp.initWorkListDomOrder(*f, &memSSA->ssa[f]);
+      fcp.initWorkListDomOrder(*f, &memSSA->ssa.at(f));
     }
     fcp.chaosIterating();
     fcp.computeDataOut();
+  }
+  {
+    Profiler::Scope profile("summary", i);
     fcp.generateSummary();
+  }
+  countProfile(i, "local");
+
+  // fcp.checkAssertions();
+  if(members.size() > 0 && Dump::enabledForAny(members)) {
+    fcp.dump("SccFCP." + (*(members.begin()))->getName().str());
+  }
 
-    // fcp.checkAssertions();
-    if(members.size() > 0) {
-      fcp.dump("SccFCP." + (*(members.begin()))->getName().str());
+  std::lock_guard<std::mutex> guard(outputLock);
+  errs() << "\nSCC " << i << " done\n";
+  fcp.countStats();
+}
+
+std::unordered_set<Value*> BuFCP::getPointToSetForVal(Value *x, Function *f) {
+  int scc = getSccNum(f);
+  demand(scc, std::vector<Value*>(1, x));
+  return sccFCP[scc].getPointToSetForVal(x);
+}
+
+void BuFCP::demand(int scc, const std::vector<Value*>& xs) {
+  if(scc == 0 || visited[scc]) {
+    return;
+  }
+  LocalFCP &fcp = sccFCP[scc];
+  auto &queries = sccQueries[scc];
+  bool analyzed = queries.size() > 0;
+
+  bool added = false;
+  for(Value *x : xs) {
+    // A Value without DUGNode does not depend on the data-flow; otherwise it is answered iff
+    // its node is in the analyzed slice.
+    if(analyzed) {
+      Instruction *node = fcp.getDUGNodeForVal(x);
+      if(node == nullptr || fcp.inSlice(node)) {
+        continue;
+      }
     }
-    fcp.countStats();
+    queries.push_back(x);
+    added = true;
   }
 
-  errs() << "\n\nBU-stage: \n";
+  if(added) {
+    // Slices are not extended incrementally (deltas of the previous run are gone), so the SCC is
+    // re-analyzed for the slice of all queries so far.
+    solveSlice(scc, queries);
+  }
+}
 
-  // Step4. Post-order inline function summary.
-  visited = std::vector<bool>(sccCount, false);
-  for(int i = 0; i < sccCount; i++) {
-    if(!visited[i]) {
-      postOrderInline(i);
+void BuFCP::solveScc(int scc) {
+  if(visited[scc]) {
+    return;
+  }
+  for(int callee : calleeSccs(scc)) {
+    solveScc(callee);
+  }
+  analyzeScc(scc);
+  postOrderInline(scc);
+  sccQueries[scc].clear();
+}
+
+void BuFCP::solveSlice(int scc, const std::vector<Value*>& queries) {
+  analyzeScc(scc, &queries);
+
+  LocalFCP &fcp = sccFCP[scc];
+  std::set<int> callees;
+  for(auto inst : fcp.slice) {
+    if(auto call = dyn_cast<CallInst>(inst)) {
+      for(auto callee : getCallees(call)) {
+        if(funcSccNum.count(callee) > 0 && getSccNum(callee) != scc) {
+          callees.insert(getSccNum(callee));
+        }
+      }
     }
   }
+  for(int callee : callees) {
+    solveScc(callee);
+  }
 
-  for(int i = 0; i < sccCount; i++) {
-    errs() << "\nSCC " << i << "\n";
-    errs() << "Member: ";
+  postOrderInline(scc);
+}
+
+void BuFCP::checkAssertionsOnDemand() {
+  for(int i = 1; i < sccCount; i++) {
+    std::vector<Value*> queries;
     for(auto f : sccMember[i]) {
-      errs() << f->getName() << ", ";
+      for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+        if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
+          if(LocalFCP::isTestingAnnotation(call)) {
+            for(unsigned j = 0; j < call->getNumArgOperands(); j++) {
+              queries.push_back(call->getArgOperand(j));
+            }
+          }
+        }
+      }
     }
-    errs() << "\n";
 
-    sccFCP[i].checkAssertions();
-    sccFCP[i].countStats();
+    if(queries.size() > 0) {
+      demand(i, queries);
+      errs() << "\nSCC " << i << " (on demand)\n";
+      sccFCP[i].checkAssertions();
+    }
   }
-  return false;
+}
+
+const std::string& BuFCP::computeSccKey(int scc) {
+  if(sccKey[scc].empty()) {
+    std::vector<std::string> calleeKeys;
+    for(int callee : calleeSccs(scc)) {
+      calleeKeys.push_back(computeSccKey(callee));
+    }
+    // Summaries imported from other modules are callees too.
+    for(auto f : sccMember[scc]) {
+      for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+        if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
+          for(auto callee : getCallees(call)) {
+            if(getImportedSummary(callee) != nullptr) {
+              calleeKeys.push_back("import " + callee->getName().str() + " " + summaries->getKey(callee->getName()));
+            }
+          }
+        }
+      }
+    }
+    sccKey[scc] = SummaryCache::computeKey(sccMember[scc], calleeKeys);
+  }
+  return sccKey[scc];
+}
+
+std::vector<int> BuFCP::calleeSccs(int scc) {
+  std::set<int> callees;
+  for(auto f : sccMember[scc]) {
+    for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+      if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
+        for(auto callee : getCallees(call)) {
+          if(funcSccNum.count(callee) > 0 && getSccNum(callee) != scc) {
+            callees.insert(getSccNum(callee));
+          }
+        }
+      }
+    }
+  }
+  return std::vector<int>(callees.begin(), callees.end());
+}
+
+void BuFCP::resolveCallees(Function *f) {
+  const DSCallGraph& callgraph = buDSA->getCallGraph();
+  DSGraph *dsg = buDSA->getDSGraph(*f);
+
+  for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+    if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
+      auto& callees = calleesOf[call];
+      if(auto callee = dyn_cast<Function>(call->getCalledValue()->stripPointerCasts())) {
+        callees.push_back(callee);
+      } else {
+        CallSite cs(call);
+        for(auto ite = callgraph.callee_begin(cs); ite != callgraph.callee_end(cs); ite++) {
+          callees.push_back(const_cast<Function*>(*ite));
+        }
+        // Keep the order (of inlining, and of placeholders) stable between runs.
+        std::sort(callees.begin(), callees.end(), [](Function *a, Function *b) {
+          return a->getName() < b->getName();
+        });
+      }
+
+      // StdLibDataStructures models known library functions in the DSGraphs of their callers. In
+      // particular, it merges the node of the returned pointer with the nodes of the arguments it
+      // may alias (e.g. for strcpy or realloc).
+      if(mayCallExternal(call) && call->getType()->isPointerTy() && dsg->hasNodeForValue(call)) {
+        DSNode *retNode = dsg->getNodeForValue(call).getNode();
+        for(auto& arg : call->arg_operands()) {
+          Value *actual = arg.get();
+          if(actual->getType()->isPointerTy() && dsg->hasNodeForValue(actual)
+             && dsg->getNodeForValue(actual).getNode() == retNode) {
+            declRetAliases[call].push_back(actual);
+          }
+        }
+      }
+    }
+  }
+}
+
+const std::vector<Function*>& BuFCP::getCallees(CallInst *call) const {
+  auto ite = calleesOf.find(call);
+  assert(ite != calleesOf.end() && "Callees should be resolved in resolveCallees()");
+  return ite->second;
+}
+
+bool BuFCP::mayCallExternal(CallInst *call) const {
+  const auto& callees = getCallees(call);
+  return callees.empty() || std::any_of(callees.begin(), callees.end(), [this](Function *callee) {
+    return callee->isDeclaration() && getImportedSummary(callee) == nullptr;
+  });
+}
+
+const FunctionSummary* BuFCP::getImportedSummary(Function *f) const {
+  auto ite = importedSummaries.find(f);
+  return ite == importedSummaries.end() ? nullptr : ite->second;
 }
 
 void BuFCP::resolveInSccCalls(Function* f) {
   for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
     if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
-      if(Function *callee = call->getCalledFunction()) {
-        if(funcSccNum.count(callee) > 0 && funcSccNum[callee] == funcSccNum[f]) {
-          // Direct call to another function in the same SCC. Splice their memSSA together.
+      for(Function *callee : getCallees(call)) {
+        if(funcSccNum.count(callee) > 0 && getSccNum(callee) == getSccNum(f)) {
+          // Call to another function in the same SCC. Splice their memSSA together.
           assert(buDSA->hasDSGraph(*f));
           DSGraph *dsg = buDSA->getDSGraph(*f);
           assert(dsg == buDSA->getDSGraph(*callee) && "Functions in the same SCC should have the same DSGraph");
@@ -177,9 +509,6 @@ void BuFCP::resolveInSccCalls(Function* f) {
             }
           }
         }
-      } else if(const Value *callee = call->getCalledValue()) {
-        // Indirect call
-        assert(0 && "NOT IMPLEMENTED YET");
       }
     } else if(auto ret = dyn_cast<ReturnInst>(&*inst_ite)) {
       retInstOfFunc[f].insert(ret);
@@ -191,14 +520,15 @@ void BuFCP::resolveSccCallsArgCopy(int scc, LocalFCP & fcp) {
   for(auto f : sccMember[scc]) {
     for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
       if (auto call = dyn_cast<CallInst>(&*inst_ite)) {
-        if(Function *callee = call->getCalledFunction()) {
-          if(funcSccNum.count(callee) > 0 && funcSccNum[callee] == funcSccNum[f]) {
-            assert(call->getNumArgOperands() == callee->getArgumentList().size()
-                   && "caller and callee don't agree with num of arguments");
-
-            // Connects actual arguments to the PHINodes of formal arguments.
-            int i = 0;
+        for(Function *callee : getCallees(call)) {
+          if(funcSccNum.count(callee) > 0 && getSccNum(callee) == getSccNum(f)) {
+            // Connects actual arguments to the PHINodes of formal arguments. Calls through casts
+            // (e.g. to K&R-style declarations) may pass fewer or more arguments than the callee has.
+            unsigned i = 0;
             for(auto& formal_ref : callee->args()) {
+              if(i >= call->getNumArgOperands()) {
+                break;
+              }
               Value *actual = call->getArgOperand(i);
               Value *formal = &formal_ref;
 
@@ -225,7 +555,7 @@ void BuFCP::resolveSccCallsArgCopy(int scc, LocalFCP & fcp) {
 
             // Connects returned values of the callee to the CallInst
             assert(retInstOfFunc.count(callee) > 0 && "ReturnInst should be identified in resolveInSccCalls()");
-            for(auto ret : retInstOfFunc[callee]) {
+            for(auto ret : retInstOfFunc.at(callee)) {
               if(auto retVal = ret->getReturnValue()) {
                 if(retVal->getType()->isPointerTy()) {
                   fcp.incomingOfArgOrRet[call].insert(retVal);
@@ -245,9 +575,6 @@ void BuFCP::resolveSccCallsArgCopy(int scc, LocalFCP & fcp) {
               }
             }
           }
-        } else if(const Value *callee = call->getCalledValue()) {
-          // Indirect call
-          assert(0 && "NOT IMPLEMENTED YET");
         }
       }
     }
@@ -255,58 +582,56 @@ void BuFCP::resolveSccCallsArgCopy(int scc, LocalFCP & fcp) {
 }
 
 void BuFCP::postOrderInline(int scc) {
-  visited[scc] = true;
-
-  // Step0. process all dependent SCCs first.
+  // Step0. all dependent SCCs are processed first (by the scheduling in runOnModule).
 
   LocalFCP& myFCP = sccFCP[scc];
   const auto& members = sccMember[scc];
+  Profiler::Scope profile("inline", scc);
 
+  if(loadedFromCache[scc]) {
+    // Callees are already inlined into the cached results.
+    releaseCalleePlaceholders(scc);
+    visited[scc] = true;
+    return;
+  }
+
+#ifndef NDEBUG
   for(auto f : members) {
     for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
       if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
-        if(auto callee = call->getCalledFunction()) {
-          if(funcSccNum.count(callee) > 0 && funcSccNum[callee] != scc
-             && not visited[funcSccNum[callee]]) {
-
-            postOrderInline(funcSccNum[callee]);
-
-          }
-        } else {
-          // Indirect call
-          assert(0 && "NOT IMPLEMENTED YET");
+        if(not myFCP.inSlice(call)) {
+          continue;
+        }
+        for(auto callee : getCallees(call)) {
+          assert((funcSccNum.count(callee) == 0 || getSccNum(callee) == scc || visited[getSccNum(callee)])
+                 && "Callee SCCs should be processed before their callers");
         }
       }
     }
   }
+#endif
 
-  // Now in this SCC, all function calls are one of:
-  //   0. calls to a function who has a summary
-  //   1. calls to an external function (function declaration)
+  // Now in this SCC, all possible callees of a call are one of:
+  //   0. functions who have a summary
+  //   1. external functions (function declarations, or unknown targets of indirect calls)
 
 
-  // Process calls to external function (function declaration) first.
-  // The strategy is simple: treating these calls return an external resource.
+  // Process calls to external functions first.
+  // The strategy is simple: unless the mod/ref model of a declaration says the returned pointer
+  // aliases some arguments (resolved at the callsite below), these calls return an external resource.
   for(auto f : members) {
     for (auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
       if (auto call = dyn_cast<CallInst>(&*inst_ite)) {
-        if (auto callee = call->getCalledFunction()) {
-          if (callee->isDeclaration() && call->getType()->isPointerTy()
-              && myFCP.DUGNodes.count(call) > 0) {
+        if (mayCallExternal(call) && declRetAliases.count(call) == 0 && call->getType()->isPointerTy()
+            && myFCP.DUGNodes.count(call) > 0) {
 
-            myFCP.externalResources.insert(call);
-            myFCP.resources.insert(call);
+          myFCP.externalResources.insert(call);
+          myFCP.resources.insert(call);
 
-            myFCP.dataIn[call].valPointTo = call;
-            myFCP.dataIn[call].valPointToSets.insert(call);
+          myFCP.dataIn[call].valPointTo = call;
+          myFCP.dataIn[call].valPointToSets.insert(call);
 
-            for(auto user : myFCP.defuseEdges[call]) {
-              if(myFCP.inList.count(user) == 0) {
-                myFCP.worklist.push(user);
-                myFCP.inList.insert(user);
-              }
-            }
-          }
+          myFCP.pushUsers(call);
         }
       }
     }
@@ -315,29 +640,37 @@ void BuFCP::postOrderInline(int scc) {
     myFCP.chaosIterating();
   }
 
-  // Now process calls to a function with a summary
+  // Now process calls to functions with a summary, and to declarations whose returned pointer
+  // aliases arguments.
 
   std::vector<CallInst*> callSitesToProcess;
 
   for(auto f : members) {
     for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
       if (auto call = dyn_cast<CallInst>(&*inst_ite)) {
-        if (auto callee = call->getCalledFunction()) {
-          if (callee->isDeclaration()) {
-            // assert(0 && "NOT IMPLEMENTED YET");
-          } else if (funcSccNum[callee] != scc) {
-            assert(funcSccNum.count(callee) > 0 && visited[funcSccNum[callee]]);
-            if(myFCP.DUGNodes.count(call) > 0) {
-              callSitesToProcess.push_back(call);
-            }
+        if (not myFCP.inSlice(call)) {
+          continue;
+        }
+        bool toMerge = declRetAliases.count(call) > 0;
+        for (auto callee : getCallees(call)) {
+          if (not callee->isDeclaration() && getSccNum(callee) != scc) {
+            assert(funcSccNum.count(callee) > 0 && visited[getSccNum(callee)]);
+            toMerge = true;
+          } else if (getImportedSummary(callee) != nullptr) {
+            toMerge = true;
           }
-        } else {
-          assert(0 && "NOT IMPLEMENTED YET");
+        }
+        if(toMerge && myFCP.DUGNodes.count(call) > 0) {
+          callSitesToProcess.push_back(call);
         }
       }
     }
   }
 
+  // If no callsite has all its arguments calculated (e.g. some are only defined in unreachable
+  // code), one of them is inlined with what is known so far.
+  bool forced = false;
+
   while(callSitesToProcess.size() > 0) {
 
     bool processedOne = false;
@@ -349,33 +682,35 @@ void BuFCP::postOrderInline(int scc) {
       bool argsCalculated = true;
       for(int i = 0; i < call->getNumArgOperands(); i++) {
         Value *actArg = call->getArgOperand(i);
+        if(isa<ConstantPointerNull>(actArg) || isa<UndefValue>(actArg)) {
+          // Points to nothing, ever.
+          continue;
+        }
         if(actArg->getType()->isPointerTy() && myFCP.getMemObjectsForVal(actArg) == nullptr) {
           argsCalculated = false;
           break;
         }
       }
 
-      if(argsCalculated) {
+      if(argsCalculated || forced) {
         // errs() << "Inlining at " << *call << " of " << call->getParent()->getParent()->getName() << "\n";
         processedOne = true;
-        mergeCallsite(call);
+        forced = false;
+        {
+          // DSGraphs of callees are shared between callers and are not safe to query concurrently,
+          // so instantiating summaries is serialized. Iterating to the fixpoint below is not.
+          std::lock_guard<std::mutex> guard(inlineLock);
+          Profiler::Scope profile("instantiate", scc);
+          mergeCallsite(call);
+        }
+        Profiler::get().count("callsites-inlined", 1, scc);
 
         // Re-run chaos-iterating.
-        auto& retMemMergePoints = memSSA->ssa[call->getParent()->getParent()].callRetMemMergePoints[call];
+        auto& retMemMergePoints = memSSA->ssa.at(call->getParent()->getParent()).callRetMemMergePoints[call];
         for(const auto& n_phi : retMemMergePoints) {
-          for(const auto& user : myFCP.defuseEdges[n_phi.second]) {
-            if(myFCP.inList.count(user) == 0) {
-              myFCP.worklist.push(user);
-              myFCP.inList.insert(user);
-            }
-          }
-        }
-        for(const auto& user : myFCP.defuseEdges[call]) {
-          if(myFCP.inList.count(user) == 0) {
-            myFCP.worklist.push(user);
-            myFCP.inList.insert(user);
-          }
+          myFCP.pushUsers(n_phi.second);
         }
+        myFCP.pushUsers(call);
         myFCP.chaosIterating();
 
         std::swap(callSitesToProcess[i], callSitesToProcess[callSitesToProcess.size() - 1]);
@@ -384,145 +719,359 @@ void BuFCP::postOrderInline(int scc) {
     }
 
     if(not processedOne) {
-      assert(false && "All callsites are not processable!");
+      forced = true;
     }
   }
 
   myFCP.computeDataOut();
-  myFCP.generateSummary();
+  if(myFCP.sliced) {
+    // Partial results only answer queries: they are neither summarized nor cached.
+    return;
+  }
+  {
+    Profiler::Scope profile("summary", scc);
+    myFCP.generateSummary();
+    buildInterfaceGraphs(scc);
+  }
+  countProfile(scc, "bu");
+
+  if(cache.enabled() && members.size() > 0) {
+    std::lock_guard<std::mutex> guard(inlineLock);
+    Profiler::Scope profile("cache-store", scc);
+    if(not cache.store(sccKey[scc], members, buDSA, memSSA, myFCP)) {
+      std::lock_guard<std::mutex> outputGuard(outputLock);
+      errs() << "SCC " << scc << " can not be cached\n";
+    }
+  }
+
+  releaseCalleePlaceholders(scc);
+  visited[scc] = true;
+}
+
+void BuFCP::countProfile(int scc, const std::string& stage) {
+  Profiler& profiler = Profiler::get();
+  if(not profiler.isEnabled()) {
+    return;
+  }
+  const LocalFCP& fcp = sccFCP[scc];
+  int64_t numEdges = 0;
+  for(const auto& kv : fcp.defuseEdges) {
+    numEdges += kv.second.size();
+  }
+  // The statistics of a LocalFCP accumulate over both stages.
+  profiler.count(stage + "-dug-nodes", fcp.DUGNodes.size(), scc);
+  profiler.count(stage + "-dug-edges", numEdges, scc);
+  profiler.count(stage + "-node-visits", fcp.numNodeVisits, scc);
+  profiler.count(stage + "-messages-passed", fcp.numMsgPassed, scc);
+}
+
+void BuFCP::releaseCalleePlaceholders(int scc) {
+  std::lock_guard<std::mutex> guard(inlineLock);
+  for(int callee : calleeSccs(scc)) {
+    pendingCallers[callee] -= 1;
+    if(pendingCallers[callee] == 0) {
+      // No caller will clone from 'callee' any more.
+      sccFCP[callee].placeholders.release();
+    }
+  }
+}
+
+void BuFCP::buildInterfaceGraphs(int scc) {
+  std::vector<Instruction*> insts;
+  for(auto f : sccMember[scc]) {
+    // Only look 'retInstOfFunc' up: SCCs are finished on different threads.
+    auto rets = retInstOfFunc.find(f);
+    if(rets != retInstOfFunc.end()) {
+      insts.insert(insts.end(), rets->second.begin(), rets->second.end());
+    }
+    for(const auto& lastDef : memSSA->ssa.at(f).retMemLastDef) {
+      insts.push_back(lastDef.second);
+    }
+  }
+  sccFCP[scc].buildInterfaceGraphs(insts);
+}
+
+void BuFCP::exportSummaries(Module &M) {
+  for(Function& F : M) {
+    if(F.isDeclaration() || F.hasLocalLinkage() || getSccNum(&F) == 0) {
+      continue;
+    }
+    Function *f = &F;
+    const LocalFCP &fcp = sccFCP[getSccNum(f)];
+    const auto& lastDefs = memSSA->ssa.at(f).retMemLastDef;
+    DSGraph *dsg = buDSA->getDSGraph(*f);
+    ModuleSummaries::Writer writer(f);
+
+    // Memory objects callers can see, by their paths from the arguments and the returned pointer.
+    MemObjectPath::forEach(f, dsg, [&](DSNode *n, const MemObjectPath& path) {
+      auto ite = lastDefs.find(n);
+      if(ite != lastDefs.end()) {
+        auto graph = fcp.interfaceGraphs.find(ite->second);
+        if(graph != fcp.interfaceGraphs.end()) {
+          writer.addMemObject(path, graph->second);
+        }
+      }
+    });
+
+    // In program order, so that the summary (and its key) is the same between runs.
+    if(f->getReturnType()->isPointerTy()) {
+      for(auto& bb : *f) {
+        if(auto ret = dyn_cast<ReturnInst>(bb.getTerminator())) {
+          auto graph = fcp.interfaceGraphs.find(ret);
+          if(graph != fcp.interfaceGraphs.end()) {
+            writer.addRet(graph->second);
+          }
+        }
+      }
+    }
+
+    summaries->add(f->getName(), writer.str());
+  }
 }
 
 void BuFCP::mergeCallsite(CallInst *call) {
   Function *caller = call->getParent()->getParent();
   assert(caller != nullptr);
 
-  if (auto callee = call->getCalledFunction()) {
-    if (callee->isDeclaration()) {
-      assert(0 && "NOT IMPLEMENTED YET");
-    } else {
-      assert(funcSccNum.count(callee) > 0 && visited[funcSccNum[callee]]);
-      DSGraph *dsgCaller = buDSA->getDSGraph(*caller);
-      DSGraph *dsgCallee = buDSA->getDSGraph(*callee);
-      assert(call->getNumArgOperands() == callee->getArgumentList().size());
-
-
-      // Mapping from Values* in callee to cloned Value* in caller.
-      std::unordered_map<Value*, Value*> cloningMapping;
-      for(auto& fml : callee->args()) {
-        if(fml.getType()->isPointerTy()) {
-          cloningMapping[&fml] = PointToGraph::getFreshExternalPlaceholder();
-          fakeValueToReal[cloningMapping[&fml]] = &fml;
+  LocalFCP &myFCP = sccFCP[getSccNum(caller)];
+  auto& retMemMergePoints = memSSA->ssa.at(caller).callRetMemMergePoints[call];
+
+  myFCP.dataOutDelta[call].clear();
+  for(auto n_phi : retMemMergePoints) {
+    myFCP.dataOutDelta[n_phi.second].clear();
+  }
+
+  // Summaries of all possible callees are merged at the callsite.
+  for(auto callee : getCallees(call)) {
+    if(not callee->isDeclaration() && getSccNum(callee) != getSccNum(caller)) {
+      mergeCallee(call, callee);
+    } else if(const FunctionSummary *summary = getImportedSummary(callee)) {
+      mergeImportedCallee(call, callee, *summary);
+    }
+  }
+
+  // The pointer returned by a declaration may alias some arguments.
+  auto aliasIte = declRetAliases.find(call);
+  if(aliasIte != declRetAliases.end()) {
+    auto& callGraph = myFCP.dataIn[call];
+    for(Value *arg : aliasIte->second) {
+      Value *argMem = myFCP.getMemObjectsForVal(arg);
+      if(argMem == nullptr) {
+        continue;
+      }
+      if(callGraph.valPointTo == nullptr) {
+        callGraph.valPointTo = argMem;
+      } else {
+        bool activated = callGraph.mergeRec(argMem, callGraph.valPointTo);
+        if(activated) {
+          myFCP.dataOutDelta[call].push_back(make_merge(argMem, callGraph.valPointTo));
         }
       }
+    }
+  }
 
+  // Instantiating several callees (or one callee several times) repeats deltas.
+  compactDeltas(myFCP.dataOutDelta[call]);
+  for(auto n_phi : retMemMergePoints) {
+    compactDeltas(myFCP.dataOutDelta[n_phi.second]);
+  }
+}
 
-      UnionFind<DSNode*> alreadyMergedNodes;
+void BuFCP::mergeCallee(CallInst *call, Function *callee) {
+  Function *caller = call->getParent()->getParent();
+
+  assert(funcSccNum.count(callee) > 0 && visited[getSccNum(callee)]);
+  DSGraph *dsgCaller = buDSA->getDSGraph(*caller);
+  DSGraph *dsgCallee = buDSA->getDSGraph(*callee);
+
+  UnionFind<DSNode*> alreadyMergedNodes;
+
+  auto& retMemMergePoints = memSSA->ssa.at(caller).callRetMemMergePoints[call];
+  LocalFCP &myFCP = sccFCP[getSccNum(caller)];
 
-      auto& retMemMergePoints = memSSA->ssa[caller].callRetMemMergePoints[call];
-      LocalFCP &myFCP = sccFCP[funcSccNum[caller]];
+  Cloning cloning(sccFCP[getSccNum(callee)].placeholders, myFCP.placeholders);
+  for(auto& fml : callee->args()) {
+    if(fml.getType()->isPointerTy()) {
+      cloning.mapping[&fml] = myFCP.placeholders.fresh(&fml);
+    }
+  }
 
-      myFCP.dataOutDelta[call].clear();
-      for(auto n_phi : retMemMergePoints) {
-        myFCP.dataOutDelta[n_phi.second].clear();
+  // For two values in callsite ('a') and callee ('b'), merge their corresponding PointToGraph.
+  auto mergeValues = [&](Value* a, Value *b) {
+    if(dsgCaller->hasNodeForValue(a) && dsgCallee->hasNodeForValue(b)) {
+      DSNodeHandle actNodeH = dsgCaller->getNodeForValue(a);
+      DSNodeHandle fmlNodeH = dsgCallee->getNodeForValue(b);
+
+      if (not alreadyMergedNodes.equivalent(actNodeH.getNode(), fmlNodeH.getNode())) {
+        mergePointToGraphByDSNodes(actNodeH, fmlNodeH, caller, call, callee, alreadyMergedNodes, cloning);
       }
 
-      // For two values in callsite ('a') and callee ('b'), merge their corresponding PointToGraph.
-      auto mergeValues = [&](Value* a, Value *b) {
-        if(dsgCaller->hasNodeForValue(a) && dsgCallee->hasNodeForValue(b)) {
-          DSNodeHandle actNodeH = dsgCaller->getNodeForValue(a);
-          DSNodeHandle fmlNodeH = dsgCallee->getNodeForValue(b);
+    }
+  };
 
-          if (not alreadyMergedNodes.equivalent(actNodeH.getNode(), fmlNodeH.getNode())) {
-            mergePointToGraphByDSNodes(actNodeH, fmlNodeH, caller, call, callee, alreadyMergedNodes, cloningMapping);
-          }
+  // Merge corresponding actual-formal arguments. Calls through casts (e.g. to K&R-style
+  // declarations) may pass fewer or more arguments than the callee has.
+  unsigned i = 0;
+  for(auto formal_ite = callee->arg_begin(); formal_ite != callee->arg_end() && i < call->getNumArgOperands();
+      formal_ite++, i++) {
 
-        }
-      };
+    Value *actual = call->getArgOperand(i);
+    Value *formal = &*formal_ite;
 
-      // Merge corresponding actual-formal arguments.
-      int i = 0;
-      for(auto formal_ite = callee->arg_begin(); formal_ite != callee->arg_end();
-          formal_ite++, i++) {
+    if(dsgCaller->hasNodeForValue(actual) && dsgCallee->hasNodeForValue(formal)) {
+      DSNodeHandle actNodeH = dsgCaller->getNodeForValue(actual);
+      DSNodeHandle fmlNodeH = dsgCallee->getNodeForValue(formal);
 
-        Value *actual = call->getArgOperand(i);
-        Value *formal = &*formal_ite;
+      if (not alreadyMergedNodes.equivalent(actNodeH.getNode(), fmlNodeH.getNode())) {
+        mergePointToGraphByDSNodes(actNodeH, fmlNodeH, caller, call, callee, alreadyMergedNodes, cloning);
+      }
 
-        if(dsgCaller->hasNodeForValue(actual) && dsgCallee->hasNodeForValue(formal)) {
-          DSNodeHandle actNodeH = dsgCaller->getNodeForValue(actual);
-          DSNodeHandle fmlNodeH = dsgCallee->getNodeForValue(formal);
+      // Merge formal and actual.
+      DSNode *actNode = actNodeH.getNode()->isGlobalNode() ? LocalMemSSA::GlobalsLeader : actNodeH.getNode();
+      PHINode *retMergePhi = retMemMergePoints[actNode];
+      assert(retMergePhi && "callsite should create a merge point for 'n' at buildSSARenaming() : MemSSA.cpp");
 
-          if (not alreadyMergedNodes.equivalent(actNodeH.getNode(), fmlNodeH.getNode())) {
-            mergePointToGraphByDSNodes(actNodeH, fmlNodeH, caller, call, callee, alreadyMergedNodes, cloningMapping);
-          }
+      Value *actMem = myFCP.getMemObjectsForVal(actual);
+      auto fmlIte = cloning.mapping.find(formal);
+
+      // They may also disagree on which of them are pointers.
+      if(actMem != nullptr && fmlIte != cloning.mapping.end()) {
+        Value *fmlMem = fmlIte->second;
+        bool activated = myFCP.dataIn[retMergePhi].mergeRec(actMem, fmlMem);
+        if(activated) {
+          myFCP.dataOutDelta[retMergePhi].push_back(make_merge(actMem, fmlMem));
+        }
+      }
+    }
+  }
 
-          // Merge formal and actual.
-          DSNode *actNode = actNodeH.getNode()->isGlobalNode() ? LocalMemSSA::GlobalsLeader : actNodeH.getNode();
-          PHINode *retMergePhi = retMemMergePoints[actNode];
-          assert(retMergePhi && "callsite should create a merge point for 'n' at buildSSARenaming() : MemSSA.cpp");
+  // Do it for return value.
+  for(auto retInst : retInstOfFunc[callee]) {
+    if(retInst->getReturnValue()) {
+      Value *callerRetValue = call;
+      Value *calleeRetValue = retInst->getReturnValue();
 
-          Value *actMem = myFCP.getMemObjectsForVal(actual);
-          Value *fmlMem = cloningMapping[formal];
+      // Clone the memory object pointed by the return value.
+      mergeValues(callerRetValue, calleeRetValue);
 
-          bool activated = myFCP.dataIn[retMergePhi].mergeRec(actMem, fmlMem);
-          if(activated) {
-            myFCP.dataOutDelta[retMergePhi].push_back(make_merge(actMem, fmlMem));
-          }
+      if(dsgCaller->hasNodeForValue(callerRetValue) && dsgCallee->hasNodeForValue(calleeRetValue)) {
+        DSNodeHandle actNodeH = dsgCaller->getNodeForValue(callerRetValue);
+        DSNodeHandle fmlNodeH = dsgCallee->getNodeForValue(calleeRetValue);
+
+        if (not alreadyMergedNodes.equivalent(actNodeH.getNode(), fmlNodeH.getNode())) {
+          mergePointToGraphByDSNodes(actNodeH, fmlNodeH, caller, call, callee, alreadyMergedNodes, cloning);
         }
+
+        // Copy the return value itself.
+        const LocalFCP& calleeFCP = sccFCP[getSccNum(callee)];
+        assert(calleeFCP.DUGNodes.count(retInst) > 0);
+        mergeReturnedValue(call, calleeFCP.interfaceGraphs.at(retInst), cloning);
       }
+    }
+  }
+}
 
-      // Do it for return value.
-      for(auto retInst : retInstOfFunc[callee]) {
-        if(retInst->getReturnValue()) {
-          Value *callerRetValue = call;
-          Value *calleeRetValue = retInst->getReturnValue();
+void BuFCP::mergeReturnedValue(CallInst *call, const CompactPointToGraph &calleeRetGraph, Cloning &cloning) {
+  if(calleeRetGraph.valPointTo == nullptr) {
+    return;
+  }
+  LocalFCP &myFCP = sccFCP[getSccNum(call->getParent()->getParent())];
+  auto& callGraph = myFCP.dataIn[call];
 
-          // Clone the memory object pointed by the return value.
-          mergeValues(callerRetValue, calleeRetValue);
+  // assert(cloning.mapping.count(calleeRetGraph.valPointTo) > 0 && "Returned memory should be cloned into the caller");
+  clonePointToGraphInto(callGraph, calleeRetGraph, cloning, myFCP.dataOutDelta[call]);
 
-          if(dsgCaller->hasNodeForValue(callerRetValue) && dsgCallee->hasNodeForValue(calleeRetValue)) {
-            DSNodeHandle actNodeH = dsgCaller->getNodeForValue(callerRetValue);
-            DSNodeHandle fmlNodeH = dsgCallee->getNodeForValue(calleeRetValue);
+  Value *returnedPtr = cloneValue(calleeRetGraph.valPointTo, cloning);
 
-            if (not alreadyMergedNodes.equivalent(actNodeH.getNode(), fmlNodeH.getNode())) {
-              mergePointToGraphByDSNodes(actNodeH, fmlNodeH, caller, call, callee, alreadyMergedNodes, cloningMapping);
-            }
+  if(callGraph.valPointTo == nullptr) {
+    callGraph.valPointTo = returnedPtr;
+    // errs() << "For " << *call << ", retval is " << PointToGraph::escape(returnedPtr) << " cloned From "
+    //        << PointToGraph::escape(calleeRetGraph.valPointTo) << "\n";
+  } else {
+    bool activated = callGraph.mergeRec(returnedPtr, callGraph.valPointTo);
+    {
+      std::lock_guard<std::mutex> guard(outputLock);
+      errs() << "For " << *call << ", retval merges with " << PointToGraph::escape(returnedPtr) << " cloned From "
+             << PointToGraph::escape(calleeRetGraph.valPointTo) << "\n";
+    }
+    if(activated) {
+      myFCP.dataOutDelta[call].push_back(make_merge(returnedPtr, callGraph.valPointTo));
+    }
+  }
+}
 
-            // Copy the return value itself.
-            LocalFCP& calleeFCP = sccFCP[funcSccNum[callee]];
-            assert(calleeFCP.DUGNodes.count(retInst) > 0);
-            auto& calleeRetGraph = calleeFCP.dataIn[retInst];
+void BuFCP::mergeImportedCallee(CallInst *call, Function *callee, const FunctionSummary &summary) {
+  Function *caller = call->getParent()->getParent();
+  DSGraph *dsgCaller = buDSA->getDSGraph(*caller);
 
-            if(calleeRetGraph.valPointTo != nullptr) {
+  const auto& retMemMergePoints = memSSA->ssa.at(caller).callRetMemMergePoints[call];
+  LocalFCP &myFCP = sccFCP[getSccNum(caller)];
 
-              auto& callGraph = myFCP.dataIn[call];
+  Cloning cloning(summary.placeholders, myFCP.placeholders);
+  for(auto& fml : callee->args()) {
+    if(fml.getType()->isPointerTy()) {
+      cloning.mapping[&fml] = myFCP.placeholders.fresh(&fml);
+    }
+  }
 
-              // assert(cloningMapping.count(calleeRetGraph.valPointTo) > 0 && "Returned memory should be cloned into the caller");
-              clonePointToGraphInto(callGraph, calleeRetGraph, cloningMapping, myFCP.dataOutDelta[call]);
+  // The merge point of the memory object the callee reaches through 'path', found by following the
+  // same links in the DSGraph of the caller (as mergePointToGraphByDSNodes does).
+  auto findMergePoint = [&](const MemObjectPath& path) -> PHINode* {
+    DSNodeHandle h;
+    if(path.root == MemObjectPath::Globals) {
+      auto ite = retMemMergePoints.find(LocalMemSSA::GlobalsLeader);
+      return ite == retMemMergePoints.end() ? nullptr : ite->second;
+    } else if(path.root == MemObjectPath::Returned) {
+      if(not dsgCaller->hasNodeForValue(call)) {
+        return nullptr;
+      }
+      h = dsgCaller->getNodeForValue(call);
+    } else {
+      if(path.argNo >= call->getNumArgOperands() || not dsgCaller->hasNodeForValue(call->getArgOperand(path.argNo))) {
+        return nullptr;
+      }
+      h = dsgCaller->getNodeForValue(call->getArgOperand(path.argNo));
+    }
+    h = path.follow(h);
+    if(h.getNode() == nullptr) {
+      return nullptr;
+    }
+    auto ite = retMemMergePoints.find(h.getNode()->isGlobalNode() ? LocalMemSSA::GlobalsLeader : h.getNode());
+    return ite == retMemMergePoints.end() ? nullptr : ite->second;
+  };
 
-              Value *returnedPtr = cloneValue(calleeRetGraph.valPointTo, cloningMapping);
+  for(const auto& obj : summary.memObjects) {
+    if(PHINode *retMergePhi = findMergePoint(obj.path)) {
+      clonePointToGraphInto(myFCP.dataIn[retMergePhi], obj.graph, cloning, myFCP.dataOutDelta[retMergePhi]);
+    }
+  }
 
-              if(callGraph.valPointTo == nullptr) {
-                callGraph.valPointTo = returnedPtr;
-                // errs() << "For " << *call << ", retval is " << PointToGraph::escape(returnedPtr) << " cloned From "
-                //        << PointToGraph::escape(calleeRetGraph.valPointTo) << "\n";
-              } else {
-                bool activated = callGraph.mergeRec(returnedPtr, callGraph.valPointTo);
-                errs() << "For " << *call << ", retval merges with " << PointToGraph::escape(returnedPtr) << " cloned From "
-                       << PointToGraph::escape(calleeRetGraph.valPointTo) << "\n";
-                if(activated) {
-                  myFCP.dataOutDelta[call].push_back(make_merge(returnedPtr, callGraph.valPointTo));
-                }
-              }
-            }
-          }
-        }
+  // Merge corresponding actual-formal arguments, as in mergeCallee.
+  unsigned i = 0;
+  for(auto formal_ite = callee->arg_begin(); formal_ite != callee->arg_end() && i < call->getNumArgOperands();
+      formal_ite++, i++) {
+    Value *actual = call->getArgOperand(i);
+    auto fmlIte = cloning.mapping.find(&*formal_ite);
+    if(fmlIte == cloning.mapping.end() || not dsgCaller->hasNodeForValue(actual)) {
+      continue;
+    }
+    DSNode *actNode = dsgCaller->getNodeForValue(actual).getNode();
+    auto phiIte = retMemMergePoints.find(actNode->isGlobalNode() ? LocalMemSSA::GlobalsLeader : actNode);
+    Value *actMem = myFCP.getMemObjectsForVal(actual);
+    if(phiIte != retMemMergePoints.end() && actMem != nullptr) {
+      Value *fmlMem = fmlIte->second;
+      bool activated = myFCP.dataIn[phiIte->second].mergeRec(actMem, fmlMem);
+      if(activated) {
+        myFCP.dataOutDelta[phiIte->second].push_back(make_merge(actMem, fmlMem));
       }
     }
-  } else {
-    // Indirect call
-    assert(0 && "NOT IMPLEMENTED YET");
   }
 
+  if(dsgCaller->hasNodeForValue(call)) {
+    for(const auto& retGraph : summary.rets) {
+      mergeReturnedValue(call, retGraph, cloning);
+    }
+  }
 }
 
 // For a CallInst ('callsite') in 'caller' to 'callee', merge the PointToGraph of
@@ -531,7 +1080,7 @@ void BuFCP::mergeCallsite(CallInst *call) {
 // And recursively merge outgoing links of 'n' and 'm'
 
 void BuFCP::mergePointToGraphByDSNodes(DSNodeHandle nh, DSNodeHandle mh, Function *caller, CallInst *callsite,
-                                       Function *callee, UnionFind<DSNode *> &mergedNodes, std::unordered_map<Value*, Value*>& cloningMapping) {
+                                       Function *callee, UnionFind<DSNode *> &mergedNodes, Cloning& cloning) {
 
   DSNode *n = nh.getNode();
   DSNode *m = mh.getNode();
@@ -540,14 +1089,17 @@ void BuFCP::mergePointToGraphByDSNodes(DSNodeHandle nh, DSNodeHandle mh, Functio
   mergedNodes.merge(n, m);
 
   // Find corresponding partial PointToGraphs for 'n' and 'm'
-  PHINode *retMergePhi = memSSA->ssa[caller].callRetMemMergePoints[callsite][n->isGlobalNode() ? LocalMemSSA::GlobalsLeader : n];
+  PHINode *retMergePhi = memSSA->ssa.at(caller).callRetMemMergePoints[callsite][n->isGlobalNode() ? LocalMemSSA::GlobalsLeader : n];
   assert(retMergePhi && "callsite should create a merge point for 'n' at buildSSARenaming() : MemSSA.cpp");
 
-  Instruction *lastDefInst = memSSA->ssa[callee].retMemLastDef[m->isGlobalNode() ? LocalMemSSA::GlobalsLeader : m];
+  // The callee is shared with its other callers, so only look it up without modifying.
+  const auto& calleeLastDef = memSSA->ssa.at(callee).retMemLastDef;
+  auto lastDefIte = calleeLastDef.find(m->isGlobalNode() ? LocalMemSSA::GlobalsLeader : m);
+  Instruction *lastDefInst = lastDefIte == calleeLastDef.end() ? nullptr : lastDefIte->second;
   assert(lastDefInst && "callee should record last definition instruction for 'm' at buildSSARenaming() : MemSSA.cpp");
 
-  LocalFCP &callerFCP = sccFCP[funcSccNum[caller]];
-  LocalFCP &calleeFCP = sccFCP[funcSccNum[callee]];
+  LocalFCP &callerFCP = sccFCP[getSccNum(caller)];
+  const LocalFCP &calleeFCP = sccFCP[getSccNum(callee)];
 
   assert(callerFCP.DUGNodes.count(retMergePhi) > 0);
   assert(calleeFCP.DUGNodes.count(lastDefInst) > 0);
@@ -555,13 +1107,12 @@ void BuFCP::mergePointToGraphByDSNodes(DSNodeHandle nh, DSNodeHandle mh, Functio
   // Copy the PointToGraph of 'lastDefInst' into the PointToGraph of 'retMergePhi'.
   PointToGraph &phiGraph = callerFCP.dataIn[retMergePhi];
 
-  auto ite = calleeFCP.dataIn.find(lastDefInst);
-  assert(ite != calleeFCP.dataIn.end() && "last definition should have a point to graph");
+  auto ite = calleeFCP.interfaceGraphs.find(lastDefInst);
+  assert(ite != calleeFCP.interfaceGraphs.end() && "last definition should have a point to graph");
 
-  PointToGraph &lastDefGraph = ite->second;
+  const CompactPointToGraph &lastDefGraph = ite->second;
 
-  // (NAIVELY) copy it!
-  clonePointToGraphInto(phiGraph, lastDefGraph, cloningMapping, callerFCP.dataOutDelta[retMergePhi]);
+  clonePointToGraphInto(phiGraph, lastDefGraph, cloning, callerFCP.dataOutDelta[retMergePhi]);
 
   // Recursively merge outgoing linked DSNodes for 'n' and 'm'.
   for(auto edge_ite = m->edge_begin(); edge_ite != m->edge_end(); edge_ite++) {
@@ -577,13 +1128,13 @@ void BuFCP::mergePointToGraphByDSNodes(DSNodeHandle nh, DSNodeHandle mh, Functio
       assert(not nOutH.isNull() && "There should be a link. Your calculation is wrong?");
 
       if(not mergedNodes.equivalent(nOutH.getNode(), edge_ite->second.getNode())) {
-        mergePointToGraphByDSNodes(nOutH, edge_ite->second, caller, callsite, callee, mergedNodes, cloningMapping);
+        mergePointToGraphByDSNodes(nOutH, edge_ite->second, caller, callsite, callee, mergedNodes, cloning);
       }
     }
   }
 }
 
-Value* BuFCP::cloneValue(Value *k, std::unordered_map<Value *, Value *> &cloned) {
+Value* BuFCP::cloneValue(Value *k, Cloning &cloned) {
   if(k == nullptr) {
     return (Value*)nullptr;
   } else if(k == PointToGraph::unspecificSpace) {
@@ -591,54 +1142,50 @@ Value* BuFCP::cloneValue(Value *k, std::unordered_map<Value *, Value *> &cloned)
   } else if(not PointToGraph::isFakeValue(k) && dyn_cast<GlobalVariable>(k)) {
     return k;
   } else {
-    Value *clonedK;
-    if(cloned.count(k) == 0) {
-      clonedK = PointToGraph::getFreshExternalPlaceholder();
-      if(fakeValueToReal.count(k) > 0) {
-        fakeValueToReal[clonedK] = fakeValueToReal[k];
-      } else {
-        fakeValueToReal[clonedK] = k;
-      }
-      cloned[k] = clonedK;
-    } else {
-      clonedK = cloned[k];
+    auto ite = cloned.mapping.find(k);
+    if(ite != cloned.mapping.end()) {
+      return ite->second;
     }
+    // Placeholders of the callee are copies of real Values themselves.
+    Value *real = cloned.from.getReal(k);
+    Value *clonedK = cloned.to.fresh(real != nullptr ? real : k);
+    cloned.mapping[k] = clonedK;
     return clonedK;
   }
 }
 
-// Brute-force-ly clone every thing of 'src' into 'dest'.
-// For any Value in 'src', a new 'fake' Value cloning is used in 'dest'.
-// The correspondence between real Value* and fake Value* is recorded in 'fakeValueToReal'.
+// Clone the classes and links of 'src' into 'dest'.
+// For any Value in 'src', a new placeholder cloning is used in 'dest'.
+// The real Value each placeholder is a copy of is recorded in the caller's placeholder arena.
 
-void BuFCP::clonePointToGraphInto(PointToGraph &dest, PointToGraph &src,
-                                  std::unordered_map<Value *, Value *> &cloned,
+void BuFCP::clonePointToGraphInto(PointToGraph &dest, const CompactPointToGraph &src, Cloning &cloned,
                                   std::vector<DeltaPointToGraph> &destDelta) {
 
-  for(auto kv : src.eqClass.leader) {
-    Value *clonedK, *clonedV;
+  std::vector<Value*> clonedLeaders;
+  for(const auto& members : src.members) {
+    Value *clonedV = cloneValue(members[0], cloned);
+    clonedLeaders.push_back(clonedV);
 
-    clonedK = cloneValue(kv.first, cloned);
-    clonedV = cloneValue(kv.second, cloned);
+    for(unsigned k = 1; k < members.size(); k++) {
+      Value *clonedK = cloneValue(members[k], cloned);
 
-    if(not dest.eqClass.equivalent(clonedK, clonedV)) {
-      bool activated = dest.mergeRec(clonedK, clonedV);
-      if(activated) {
-        destDelta.push_back(make_merge(clonedK, clonedV));
+      if(not dest.equivalent(clonedK, clonedV)) {
+        bool activated = dest.mergeRec(clonedK, clonedV);
+        if(activated) {
+          destDelta.push_back(make_merge(clonedK, clonedV));
+        }
       }
     }
   }
 
-  for(auto kv : src.pointTo) {
-    if(src.eqClass.find(kv.first) == kv.first) {
-      Value *clonedK, *clonedV;
-
-      clonedK = cloneValue(kv.first, cloned);
-      clonedV = cloneValue(kv.second, cloned);
+  for(unsigned c = 0; c < src.pointTo.size(); c++) {
+    if(src.pointTo[c] >= 0) {
+      Value *clonedK = clonedLeaders[c];
+      Value *clonedV = clonedLeaders[src.pointTo[c]];
 
       Value *clonedKTo = dest.getPointTo(clonedK);
 
-      if(clonedKTo == nullptr || not dest.eqClass.equivalent(clonedV, clonedKTo)) {
+      if(clonedKTo == nullptr || not dest.equivalent(clonedV, clonedKTo)) {
         if(clonedKTo == nullptr) {
           dest.setPointTo(clonedK, clonedV);
         } else {
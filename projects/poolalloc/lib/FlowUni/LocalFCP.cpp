@@ -5,17 +5,40 @@
 // #define __DBGFCP
 
 #include "flowuni/LocalFCP.h"
+#include "flowuni/Dump.h"
 #include "flowuni/MemSSA.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 #include <unordered_set>
 #include <cmath>
+#include <climits>
 
 using namespace llvm;
 
 namespace{
   static RegisterPass<LocalFCPWrapper> X("flowuni-local", "Flow-sensitive unification based points-to analysis", true, true);
 
+  static cl::opt<DUGWorklist::Strategy> WorklistStrategy("flowuni-worklist",
+         cl::desc("Order in which FlowUni visits pending DUG nodes"),
+         cl::values(clEnumValN(DUGWorklist::FIFO, "fifo", "First in, first out (default)"),
+                    clEnumValN(DUGWorklist::LIFO, "lifo", "Last in, first out"),
+                    clEnumValN(DUGWorklist::RPO, "rpo", "Earliest pending node in reverse post-order"),
+                    clEnumValN(DUGWorklist::Wavefront, "wavefront",
+                               "Reverse post-order sweeps, re-queued nodes wait for the next sweep"),
+                    clEnumValEnd),
+         cl::init(DUGWorklist::FIFO));
+
+  static cl::opt<bool> SimplifyDUG("flowuni-simplify-dug",
+         cl::desc("Remove pass-through nodes from the def-use graph before iterating"),
+         cl::init(true));
+
+  static cl::opt<bool> FieldSensitive("flowuni-field-sensitive",
+         cl::desc("Tell apart the fields of stack objects whose DSNodes stay local to their function"),
+         cl::init(false));
+
   template<typename ... Args>
   std::string string_format( const std::string& format, Args ... args )
   {
@@ -42,7 +65,7 @@ bool LocalFCPWrapper::runOnModule(Module &M) {
   for(auto& F : M) {
     if(F.isDeclaration() == false) {
       inner.runOnFunction(F, &(localSSA->ssa[&F]));
-      localFCP[&F] = inner;
+      localFCP[&F] = std::move(inner);
     }
   }
   return false;
@@ -57,22 +80,40 @@ void LocalFCP::clear() {
   nodeSSA.clear();
   defuseEdges.clear();
   usedefEdges.clear();
-  while(!worklist.empty()) {
-    worklist.pop();
-  }
-  inList.clear();
+  worklist.reset(WorklistStrategy);
   dataOutDelta.clear();
   dataOutInDiff.clear();
+  dugNodes.clear();
+  dugNodeIds.clear();
+  userBegin.clear();
+  userTargets.clear();
+  defBegin.clear();
+  defSources.clear();
+  nodeIn.clear();
+  nodeOutDelta.clear();
+  nodeOutInDiff.clear();
+  nodeForGlobals.clear();
+  lastVisit.clear();
+  visitClock = 0;
+  emittedDiff.clear();
   implicitArgsPointedBy.clear();
   externalResources.clear();
-  summary = PointToGraph();
+  fieldBase.clear();
+  placeholders.reset();
+  numbering = std::make_shared<ResourceNumbering>();
+  summary = PointToGraph(numbering.get());
   argSetInst.clear();
   setInstArg.clear();
   fakePhiSource.clear();
   incomingOfArgOrRet.clear();
+  passThrough.clear();
+  interfaceGraphs.clear();
+  sliced = false;
+  slice.clear();
 
-  numEdges = numInstDUG = numFakePhiDUG = numMsgPassed = numMsgPassedForGlobals = 0;
+  numEdges = numInstDUG = numFakePhiDUG = numNodeVisits = numMsgPassed = numMsgPassedForGlobals = 0;
   numArgValFakePhi = numSSAFakePhi = numArgMemFakePhi = numCallRetFakePhi = 0;
+  numNodesBeforeSimplify = numEdgesBeforeSimplify = numPassThroughRemoved = numFakePhiRemoved = 0;
 }
 
 bool LocalFCP::runOnFunction(Function &F, LocalMemSSA *memSSA) {
@@ -84,10 +125,14 @@ bool LocalFCP::runOnFunction(Function &F, LocalMemSSA *memSSA) {
 
   identifyDUGNodes(F, memSSA);
 
+  identifyFields(F, memSSA);
+
   identifyDUGEdges();
 
   simplifyDUG();
 
+  numberDUG();
+
   initWorkListDomOrder(F, memSSA);
 
   chaosIterating();
@@ -96,11 +141,17 @@ bool LocalFCP::runOnFunction(Function &F, LocalMemSSA *memSSA) {
 
   generateSummary();
 
-  dumpSummary("localSum." + F.getName().str());
+  bool dumped = Dump::enabledFor(&F);
+  if(dumped) {
+    memSSA->dump();
+    dumpSummary("localSum." + F.getName().str());
+  }
 
   checkAssertions();
 
-  dump("localFCP." + F.getName().str());
+  if(dumped) {
+    dump("localFCP." + F.getName().str());
+  }
 
   return false;
 }
@@ -127,7 +178,9 @@ void LocalFCP::identifyResources(Function& F) {
           assert(cexpr->getNumOperands() == 1);
           op_reduced = cexpr->getOperand(0);
         } else {
+#ifdef __DBGFCP
           errs() << "Unrecognized ConstantExpr: " << *op_reduced << "\n";
+#endif
           break;
         }
       }
@@ -268,6 +321,11 @@ void LocalFCP::identifyDUGEdges() {
     }
   }
 
+  // Every DUGNode gets a (still empty) point-to graph over the numbering of this SCC.
+  for(auto inst : DUGNodes) {
+    dataIn.emplace(inst, PointToGraph(numbering.get()));
+  }
+
 #ifdef __DBGFCP
   for(auto inst : DUGNodes) {
     errs() << "Predecessor of " << *inst << ":\n";
@@ -284,15 +342,16 @@ void LocalFCP::initWorkListDomOrder(Function &F, LocalMemSSA* memSSA) {
   // (If 'a' dominates 'b', then 'a' precedes 'b' in the initial worklist). This is crucial
   // to guarantee for every instruction in the iteration process, its used Values were
   // calculated at least once.
+  // Nodes are queued with their priorities, so those are assigned first.
+  assignWorkListPriorities(F, memSSA);
+
   for(const auto& kv : memSSA->argIncomingMergePoint) {
-    worklist.push(kv.second);
-    inList.insert(kv.second);
+    pushNode(kv.second);
   }
 
   for(auto arg_ite = F.arg_begin(); arg_ite != F.arg_end(); arg_ite++) {
     if(argSetInst.count(&*arg_ite)) {
-      worklist.push(argSetInst[&*arg_ite]);
-      inList.insert(argSetInst[&*arg_ite]);
+      pushNode(argSetInst[&*arg_ite]);
     }
   }
 
@@ -300,50 +359,331 @@ void LocalFCP::initWorkListDomOrder(Function &F, LocalMemSSA* memSSA) {
   initWorkListDomOrder(memSSA, &F.getEntryBlock(), __visitedBB);
 }
 
+void LocalFCP::assignWorkListPriorities(Function &F, LocalMemSSA *memSSA) {
+  // Number the DUGNodes of 'F' in reverse post-order of the CFG, continuing after the
+  // functions of this SCC numbered before. Merge points of arguments come first; the merge
+  // points of a call come right before the call, and fake PHINodes at the head of their block.
+  unsigned next = worklist.numPriorities();
+  auto prioritize = [&](Instruction *inst) {
+    auto ite = dugNodeIds.find(inst);
+    if(ite != dugNodeIds.end()) {
+      worklist.setPriority(ite->second, next++);
+    }
+  };
+
+  for(const auto& kv : memSSA->argIncomingMergePoint) {
+    prioritize(kv.second);
+  }
+  for(auto arg_ite = F.arg_begin(); arg_ite != F.arg_end(); arg_ite++) {
+    if(argSetInst.count(&*arg_ite)) {
+      prioritize(argSetInst[&*arg_ite]);
+    }
+  }
+
+  ReversePostOrderTraversal<Function*> rpot(&F);
+  for(BasicBlock *bb : rpot) {
+    for(auto& n_phi : memSSA->phiNodes[bb]) {
+      prioritize(n_phi.second);
+    }
+    for(auto& I : *bb) {
+      if(auto call = dyn_cast<CallInst>(&I)) {
+        auto ite = memSSA->callRetMemMergePoints.find(call);
+        if(ite != memSSA->callRetMemMergePoints.end()) {
+          for(const auto& np : ite->second) {
+            prioritize(np.second);
+          }
+        }
+      }
+      prioritize(&I);
+    }
+  }
+}
+
+Value* LocalFCP::getPassThroughSource(Instruction *inst) {
+  if(resources.count(inst) > 0) {
+    return nullptr;
+  }
+  // Point-to sets of values passed to calls are queried at the callsite (e.g. by checkAssertions()),
+  // so such values keep their nodes.
+  for(auto user : inst->users()) {
+    if(dyn_cast<CallInst>(user)) {
+      return nullptr;
+    }
+  }
+
+  if(auto gep = dyn_cast<GetElementPtrInst>(inst)) {
+    // Field-insensitive: a GEP points to what its pointer operand points to.
+    return gep->getPointerOperand();
+  } else if(auto cast = dyn_cast<BitCastInst>(inst)) {
+    if(cast->getSrcTy()->isPointerTy() && cast->getDestTy()->isPointerTy()) {
+      return cast->getOperand(0);
+    }
+  } else if(auto phi = dyn_cast<PHINode>(inst)) {
+    if(phi->getType()->isPointerTy() && setInstArg.count(phi) == 0) {
+      // A real PHINode whose incoming values are all the same Value (e.g. LCSSA PHINodes).
+      Value *src = nullptr;
+      for(auto& in : phi->incoming_values()) {
+        if(src != nullptr && in.get() != src) {
+          return nullptr;
+        }
+        src = in.get();
+      }
+      return src != phi ? src : nullptr;
+    }
+  }
+  return nullptr;
+}
+
 void LocalFCP::simplifyDUG() {
-  // TODO: remove redundant DUGNodes, for example:
-  //   1. PHINodes for non-pointer variables,
-  //   2. LLVM debug declaring calls,
-  //   3. PHINodes with only one incoming and outgoing edge.
-  int removeable = 0;
+  // Nodes whose transfer function is the identity only forward the deltas of their predecessors,
+  // so they are removed by connecting their predecessors to their users directly:
+  //   1. GEPs, pointer BitCasts and single-valued PHINodes. Users of such a Value look up the
+  //      Value it passes through instead (see 'passThrough').
+  //   2. Fake PHINodes of the memory SSA with a single incoming edge.
+  numNodesBeforeSimplify = DUGNodes.size();
+  numEdgesBeforeSimplify = 0;
+  for(const auto& kv : defuseEdges) {
+    numEdgesBeforeSimplify += kv.second.size();
+  }
+  if(!SimplifyDUG) {
+    return;
+  }
+
+  // Fake PHINodes referred to by the inter-procedural phase: merge points of arguments and
+  // callsites, and last definitions of memory objects.
+  std::unordered_set<Instruction*> pinned;
+  std::unordered_set<LocalMemSSA*> memSSAs;
+  for(const auto& kv : nodeSSA) {
+    memSSAs.insert(kv.second);
+  }
+  for(auto memSSA : memSSAs) {
+    for(const auto& kv : memSSA->argIncomingMergePoint) {
+      pinned.insert(kv.second);
+    }
+    for(const auto& kv : memSSA->callRetMemMergePoints) {
+      for(const auto& np : kv.second) {
+        pinned.insert(np.second);
+      }
+    }
+    for(const auto& kv : memSSA->retMemLastDef) {
+      pinned.insert(kv.second);
+    }
+    for(const auto& kv : memSSA->callArgLastDef) {
+      for(const auto& nd : kv.second) {
+        pinned.insert(nd.second);
+      }
+    }
+  }
+
+  std::vector<Instruction*> candidates(DUGNodes.begin(), DUGNodes.end());
+  for(auto inst : candidates) {
+    Value *src = getPassThroughSource(inst);
+    // Deltas of an AllocaInst are only applied by its users in the memory SSA (see chaosIterating()),
+    // so a PHINode fed by an AllocaInst can not be bypassed.
+    bool fakePhi = src == nullptr && fakePhiSource.count(inst) > 0 && pinned.count(inst) == 0
+                   && usedefEdges[inst].size() == 1 && !dyn_cast<AllocaInst>(*usedefEdges[inst].begin());
+    if(src == nullptr && !fakePhi) {
+      continue;
+    }
+
+    auto& preds = usedefEdges[inst];
+    auto& users = defuseEdges[inst];
+    bool onCycle = preds.count(inst) > 0;
+    for(auto pred : preds) {
+      onCycle = onCycle || users.count(pred) > 0;
+    }
+    if(onCycle) {
+      continue;
+    }
+
+    for(auto pred : preds) {
+      defuseEdges[pred].erase(inst);
+      for(auto user : users) {
+        defuseEdges[pred].insert(user);
+        usedefEdges[user].insert(pred);
+      }
+    }
+    for(auto user : users) {
+      usedefEdges[user].erase(inst);
+    }
+
+    if(src != nullptr) {
+      passThrough[inst] = src;
+      numPassThroughRemoved += 1;
+    } else {
+      numFakePhiRemoved += 1;
+    }
+    defuseEdges.erase(inst);
+    usedefEdges.erase(inst);
+    DUGNodes.erase(inst);
+    dataIn.erase(inst);
+    nodeSSA.erase(inst);
+  }
+}
+
+void LocalFCP::numberDUG() {
+  // Nodes are numbered function by function in the order of their blocks, so that the nodes
+  // visited one after another tend to be close in the arrays.
+  dugNodes.clear();
+  dugNodeIds.clear();
+  auto number = [&](Instruction *inst) {
+    if(DUGNodes.count(inst) > 0 && dugNodeIds.emplace(inst, dugNodes.size()).second) {
+      dugNodes.push_back(inst);
+    }
+  };
+  // (Fake PHINodes are not in any block.)
+  std::unordered_map<LocalMemSSA*, Function*> funcs;
+  for(const auto& kv : nodeSSA) {
+    if(BasicBlock *bb = kv.first->getParent()) {
+      funcs[kv.second] = bb->getParent();
+    }
+  }
+  for(const auto& kv : funcs) {
+    LocalMemSSA *memSSA = kv.first;
+    Function *F = kv.second;
+    for(const auto& kv : memSSA->argIncomingMergePoint) {
+      number(kv.second);
+    }
+    for(auto arg_ite = F->arg_begin(); arg_ite != F->arg_end(); arg_ite++) {
+      auto ite = argSetInst.find(&*arg_ite);
+      if(ite != argSetInst.end()) {
+        number(ite->second);
+      }
+    }
+    for(auto& bb : *F) {
+      auto phis = memSSA->phiNodes.find(&bb);
+      if(phis != memSSA->phiNodes.end()) {
+        for(const auto& n_phi : phis->second) {
+          number(n_phi.second);
+        }
+      }
+      for(auto& I : bb) {
+        if(auto call = dyn_cast<CallInst>(&I)) {
+          auto ite = memSSA->callRetMemMergePoints.find(call);
+          if(ite != memSSA->callRetMemMergePoints.end()) {
+            for(const auto& np : ite->second) {
+              number(np.second);
+            }
+          }
+        }
+        number(&I);
+      }
+    }
+  }
   for(auto inst : DUGNodes) {
-    if(defuseEdges[inst].size() == 0 && usedefEdges[inst].size() == 0) {
-      removeable += 1;
-    } else if(defuseEdges[inst].size() == 1 && usedefEdges[inst].size() == 1 && dyn_cast<PHINode>(inst)){
-      removeable += 1;
+    number(inst);
+  }
+
+  unsigned numNodes = dugNodes.size();
+  userBegin.assign(1, 0);
+  userTargets.clear();
+  defBegin.assign(1, 0);
+  defSources.clear();
+  nodeIn.resize(numNodes);
+  nodeOutDelta.resize(numNodes);
+  nodeOutInDiff.resize(numNodes);
+  nodeForGlobals.clear();
+  nodeForGlobals.resize(numNodes);
+  lastVisit.assign(numNodes, 0);
+  visitClock = 0;
+
+  for(DUGNodeId node = 0; node < numNodes; node++) {
+    Instruction *inst = dugNodes[node];
+
+    auto users = defuseEdges.find(inst);
+    if(users != defuseEdges.end()) {
+      for(auto user : users->second) {
+        auto ite = dugNodeIds.find(user);
+        if(ite != dugNodeIds.end()) {
+          userTargets.push_back(ite->second);
+        }
+      }
+    }
+    userBegin.push_back(userTargets.size());
+
+    auto defs = usedefEdges.find(inst);
+    if(defs != usedefEdges.end()) {
+      for(auto def : defs->second) {
+        if(dyn_cast<AllocaInst>(def) && nodeSSA[inst]->memSSADefs[inst].count(def) == 0) {
+          // If it is only a value reference to an AllocInst, don't apply Alloca's modification to memory.
+          // FIXME: do this in a more elegant way.
+          continue;
+        }
+        auto ite = dugNodeIds.find(def);
+        if(ite != dugNodeIds.end()) {
+          defSources.push_back(ite->second);
+        }
+      }
+    }
+    defBegin.push_back(defSources.size());
+
+    nodeIn[node] = &dataIn.at(inst);
+    nodeOutDelta[node] = &dataOutDelta[inst];
+    nodeOutInDiff[node] = &dataOutInDiff[inst];
+    auto source = fakePhiSource.find(inst);
+    if(source != fakePhiSource.end() && source->second == LocalMemSSA::GlobalsLeader) {
+      nodeForGlobals.set(node);
+    }
+  }
+
+  worklist.resize(numNodes);
+}
+
+void LocalFCP::pushUsers(Instruction *inst) {
+  auto ite = dugNodeIds.find(inst);
+  if(ite == dugNodeIds.end()) {
+    return;
+  }
+  DUGNodeId node = ite->second;
+  for(unsigned e = userBegin[node]; e < userBegin[node + 1]; e++) {
+    worklist.push(userTargets[e]);
+  }
+}
+
+bool LocalFCP::usersVisitedSince(DUGNodeId node, unsigned visit) const {
+  for(unsigned e = userBegin[node]; e < userBegin[node + 1]; e++) {
+    DUGNodeId user = userTargets[e];
+    if(user != node && lastVisit[user] < visit) {
+      return false;
     }
   }
-  errs() << "Num of removable nodes: " << removeable << "\n";
+  return true;
 }
 
 void LocalFCP::chaosIterating() {
 
   while(!worklist.empty()) {
-    Instruction *inst = worklist.front();
-    worklist.pop();
-    inList.erase(inst);
+    DUGNodeId node = worklist.pop();
+    Instruction *inst = dugNodes[node];
+    unsigned prevVisit = lastVisit[node];
+    lastVisit[node] = ++visitClock;
+    if(!inSlice(inst)) {
+      continue;
+    }
+    numNodeVisits += 1;
 
-    assert(DUGNodes.count(inst) > 0);
     // errs() << "chaos-iteration on " << *inst << "\n";
 
     // The input data-flow data.
-    auto& in = dataIn[inst];
-    auto& outDelta = dataOutDelta[inst];
+    auto& in = *nodeIn[node];
+    auto& outDelta = *nodeOutDelta[node];
     auto& inDelta = outDelta;
 
+    // A user reads the deltas of the last visit of a node only. If the strategy visits the node
+    // again before some of its users (e.g. RPO), the deltas they have not applied yet are sent
+    // again with the new ones. Users that did apply them find nothing new in them.
+    std::vector<DeltaPointToGraph> unapplied;
+    if(!outDelta.empty() && !usersVisitedSince(node, prevVisit)) {
+      unapplied.swap(outDelta);
+    }
     outDelta.clear();
 
     // Update 'dataIn' for 'inst' from all its predecessors.
-    for(auto def: usedefEdges[inst]) {
-      if(dyn_cast<AllocaInst>(def) && nodeSSA[inst]->memSSADefs[inst].count(def) == 0 ) {
-        // If it is only a value reference to an AllocInst, don't apply Alloca's modification to memory.
-        // FIXME: do this in a more elegant way.
-        continue;
-      }
-
-      for(const auto& delta: dataOutDelta[def]) {
+    for(unsigned e = defBegin[node]; e < defBegin[node + 1]; e++) {
+      DUGNodeId def = defSources[e];
+      for(const auto& delta: *nodeOutDelta[def]) {
         numMsgPassed += 1;
-        if(fakePhiSource.count(inst) > 0 && fakePhiSource[inst] == LocalMemSSA::GlobalsLeader) {
+        if(nodeForGlobals.test(node)) {
           numMsgPassedForGlobals += 1;
         }
         if(delta.type == DeltaPointToGraph::Type::Merge) {
@@ -352,7 +692,7 @@ void LocalFCP::chaosIterating() {
             inDelta.push_back(delta);
           }
 #ifdef __DBGFCP
-          errs() << "0merge before " << *inst << "( from " << *def << ") for "<< PointToGraph::escape(delta.x) << " and " << PointToGraph::escape(delta.y) << "\n";
+          errs() << "0merge before " << *inst << "( from " << *dugNodes[def] << ") for "<< PointToGraph::escape(delta.x) << " and " << PointToGraph::escape(delta.y) << "\n";
 #endif
         } else if(delta.type == DeltaPointToGraph::Type::PointTo) {
           Value *xTo = in.getPointTo(delta.x);
@@ -360,7 +700,7 @@ void LocalFCP::chaosIterating() {
             in.setPointTo(delta.x, delta.y);
             inDelta.push_back(delta);
 #ifdef __DBGFCP
-            errs() << "0set pointTo before " << *inst << "( from " << *def << ") for "<< PointToGraph::escape(delta.x) << " and " << PointToGraph::escape(delta.y) << "\n";
+            errs() << "0set pointTo before " << *inst << "( from " << *dugNodes[def] << ") for "<< PointToGraph::escape(delta.x) << " and " << PointToGraph::escape(delta.y) << "\n";
 #endif
           } else {
             bool activated = in.mergeRec(delta.y, xTo);
@@ -368,7 +708,7 @@ void LocalFCP::chaosIterating() {
               inDelta.push_back(delta);
             }
 #ifdef __DBGFCP
-            errs() << "1merge before " << *inst << "( from " << *def << ") for "<< PointToGraph::escape(xTo) << " and " << PointToGraph::escape(delta.y) << "\n";
+            errs() << "1merge before " << *inst << "( from " << *dugNodes[def] << ") for "<< PointToGraph::escape(xTo) << " and " << PointToGraph::escape(delta.y) << "\n";
 #endif
           }
         }
@@ -388,10 +728,14 @@ void LocalFCP::chaosIterating() {
 
     if(auto load = dyn_cast<LoadInst>(inst)) {
       auto ptr = load->getPointerOperand();
-      auto ptrMem = getMemObjectsForVal(ptr);   // resource equivalent class pointed by 'ptr'
+      auto ptrMem = getMemLocation(in, ptr, inst);   // resource equivalent class pointed by 'ptr'
       auto ptrTo = in.getPointTo(ptrMem);
 
       outDelta.clear();
+      if(ptrMem != nullptr && ptrTo == nullptr && in.equivalent(ptrMem, PointToGraph::unspecificSpace)) {
+        // Loading through a pointer not initialized (on some path): nothing is known.
+        ptrMem = nullptr;
+      }
       if(ptrMem != nullptr) {
 
         if(ptrTo == nullptr) {
@@ -414,22 +758,19 @@ void LocalFCP::chaosIterating() {
           valPtrChanged = true;
         }
         if(in.valPointTo != nullptr) {
-          auto ptrToLeader = in.eqClass.find(in.valPointTo);
+          auto ptrToLeader = in.find(in.valPointTo);
 
-          // The following code calculate dataOut for LoadInst by brute force, i.e.,
-          // by checking whether EVERY Value* is equivalent with 'in.valPointTo'.
-          // This may be tracked in a smarter and economic way.
+          // Every member of the class pointed by 'in.valPointTo' not reported yet is new.
 
           if(in.valPointToSets.count(ptrToLeader) == 0) {
             in.valPointToSets.insert(ptrToLeader);
             outDelta.push_back(make_merge(ptrToLeader, in.valPointTo));
           }
 
-          for(auto kv : in.eqClass.leader) {
-            if(in.valPointToSets.count(kv.first) == 0 &&
-               in.eqClass.equivalent(kv.first, ptrToLeader)) {
-              in.valPointToSets.insert(kv.first);
-              outDelta.push_back(make_merge(kv.first, ptrToLeader));
+          for(Value *v : in.getClassMembers(ptrToLeader)) {
+            if(in.valPointToSets.count(v) == 0) {
+              in.valPointToSets.insert(v);
+              outDelta.push_back(make_merge(v, ptrToLeader));
             }
           }
         }
@@ -437,11 +778,13 @@ void LocalFCP::chaosIterating() {
     } else if(dyn_cast<StoreInst>(inst) != nullptr || dyn_cast<AllocaInst>(inst) != nullptr) {
 
       Value *ptrMem = nullptr, *contentMem = nullptr;
+      // Fields of the object defined by an AllocaInst, not initialized either.
+      const ResourceNumbering::FieldList *fields = nullptr;
 
       if(auto store = dyn_cast<StoreInst>(inst)) {
         auto ptr = store->getPointerOperand();
         auto content = store->getValueOperand();
-        ptrMem = getMemObjectsForVal(ptr);
+        ptrMem = getMemLocation(in, ptr, inst);
         contentMem = getMemObjectsForVal(content);
       } else if(auto alloca = dyn_cast<AllocaInst>(inst)){
         // AllocaInst is treated as storing an 'unspecified' value into the the memory.
@@ -452,26 +795,39 @@ void LocalFCP::chaosIterating() {
         }
         ptrMem = alloca;
         contentMem = PointToGraph::unspecificSpace;
+        if(!fieldBase.empty()) {
+          fields = numbering->getFields(numbering->getId(alloca));
+        }
+      }
+
+      for(unsigned f = 0; fields != nullptr && f < fields->size(); f++) {
+        Value *field = numbering->getValue((*fields)[f].second);
+        auto delta = make_pointTo(field, contentMem);
+        outInDiff.push_back(delta);
+        if(!isEmitted(delta, node)) {
+          outDelta.push_back(delta);
+        }
+      }
+
+      if(ptrMem != nullptr && in.getPointTo(ptrMem) == nullptr && in.equivalent(ptrMem, PointToGraph::unspecificSpace)) {
+        // Storing through a pointer not initialized (on some path) defines nothing.
+        ptrMem = nullptr;
       }
 
       if(ptrMem && contentMem) {
-        if(in.eqClass.getRank(ptrMem) == 0 /* && externalResources.count(ptrMem) == 0*/) {
+        if(isStrongUpdatable(in, ptrMem) /* && externalResources.count(ptrMem) == 0*/) {
           // ptrMem is a singleton equivalent class. Perform strong update.
 
           // Overwrite all previous 'pointTo' modification of this memory object.
-          for(auto ite = outDelta.begin(); ite != outDelta.end(); ) {
-            auto inDel = *ite;
-            if(inDel.type == DeltaPointToGraph::Type::PointTo && in.eqClass.equivalent(inDel.x, ptrMem)) {
-              ite = outDelta.erase(ite);
-            } else {
-              ++ite;
-            }
-          }
+          outDelta.erase(std::remove_if(outDelta.begin(), outDelta.end(), [&](const DeltaPointToGraph& inDel) {
+            return inDel.type == DeltaPointToGraph::Type::PointTo && in.equivalent(inDel.x, ptrMem);
+          }), outDelta.end());
 
+          // The update stays in the difference to the input data even once users have it.
           auto delta = make_pointTo(ptrMem, contentMem);
-          if(!isEmitted(delta, inst)) {
+          outInDiff.push_back(delta);
+          if(!isEmitted(delta, node)) {
             outDelta.push_back(delta);
-            outInDiff.push_back(delta);
 
 #ifdef __DBGFCP
             errs() << "strong update for: " << PointToGraph::escape(ptrMem) << ", at " << *inst << ", " << " to " << PointToGraph::escape(contentMem) << "\n";
@@ -481,11 +837,13 @@ void LocalFCP::chaosIterating() {
           // ptrMem is not a unique memory resource. Perform weak update.
           auto ptrTo = in.getPointTo(ptrMem);
 
-          if(ptrTo == nullptr || !in.eqClass.equivalent(ptrTo, contentMem)) {
+          if(ptrTo == nullptr || !in.equivalent(ptrTo, contentMem)) {
             if(ptrTo == nullptr) {
               assert(externalResources.count(ptrMem) > 0 && "Non-external memory objects should always points to something");
               auto ptrToNew = getImplicitArgOf(ptrMem);
+#ifdef __DBGFCP
               errs() << "get implicit argument at " << *inst << ", for " << PointToGraph::escape(ptrMem) << ", result: " << PointToGraph::escape(ptrToNew) << "\n";
+#endif
               auto delta = make_pointTo(ptrMem, ptrToNew);
               outDelta.push_back(delta);
               outInDiff.push_back(delta);
@@ -493,9 +851,9 @@ void LocalFCP::chaosIterating() {
             }
 
             auto delta = make_pointTo(ptrMem, contentMem);
-            if(!isEmitted(delta, inst)) {
+            outInDiff.push_back(delta);
+            if(!isEmitted(delta, node)) {
               outDelta.push_back(delta);
-              outInDiff.push_back(delta);
             }
           }
         }
@@ -543,8 +901,9 @@ void LocalFCP::chaosIterating() {
         }
       }
     } else if(auto gep = dyn_cast<GetElementPtrInst>(inst)) {
-      // Our implementation is field-insensitive so the GEP instruction is treated as
-      // directly returning the pointer operand.
+      // The GEP instruction is treated as directly returning the pointer operand. (With
+      // -flowuni-field-sensitive, loads and stores tell the field apart by the offset DSA gives
+      // to their pointer.)
       auto src = gep->getPointerOperand();
       auto srcMem = getMemObjectsForVal(src);
       if(in.valPointTo == nullptr && srcMem != nullptr) {
@@ -576,19 +935,34 @@ void LocalFCP::chaosIterating() {
       }
     } else {
       // TODO: other instructions
+#ifdef __DBGFCP
       errs() << "Unknown instruction type: " << *inst << "\n";
+#endif
     }
 
+    compactDeltas(outDelta);
     if(outDelta.size() > 0 || valPtrChanged) {
-      for(auto user : defuseEdges[inst]) {
-        if(inList.count(user) == 0) {
-          worklist.push(user);
-          inList.insert(user);
-        }
+      for(unsigned e = userBegin[node]; e < userBegin[node + 1]; e++) {
+        worklist.push(userTargets[e]);
       }
     }
+    // The users which have not applied the deltas of the previous visit are still pending.
+    if(!unapplied.empty()) {
+      outDelta.insert(outDelta.begin(), unapplied.begin(), unapplied.end());
+      compactDeltas(outDelta);
+    }
 
-    dataOutInDiff[inst] = outInDiff;
+    if(outInDiff.size() > 0 || nodeOutInDiff[node]->size() > 0) {
+      EmittedDeltas& emitted = emittedDiff[node];
+      emitted.deltas.clear();
+      for(auto& delta : outInDiff) {
+        delta.x = in.find(delta.x);
+        delta.y = in.find(delta.y);
+        emitted.deltas.insert(delta);
+      }
+      emitted.numMerges = in.getNumMerges();
+    }
+    *nodeOutInDiff[node] = std::move(outInDiff);
   }
 }
 
@@ -601,11 +975,9 @@ void LocalFCP::computeDataOut() {
     if(dataIn[inst].valPointTo != nullptr) {
       auto& in = dataIn[inst];
       Value *ptr = in.valPointTo;
-      in.valPointToSets.insert(in.eqClass.find(ptr));
-      for(auto& kv : in.eqClass.leader) {
-        if(in.eqClass.equivalent(kv.first, ptr)) {
-          in.valPointToSets.insert(kv.first);
-        }
+      in.valPointToSets.insert(in.find(ptr));
+      for(Value *v : in.getClassMembers(ptr)) {
+        in.valPointToSets.insert(v);
       }
     }
 
@@ -620,16 +992,24 @@ void LocalFCP::computeDataOut() {
   }
 }
 
-bool LocalFCP::isEmitted(const DeltaPointToGraph &d, Instruction *i) {
-  auto& in = dataIn[i];
-  for(const auto& emitted : dataOutInDiff[i]) {
-    if(emitted.type == d.type) {
-      if(in.eqClass.equivalent(emitted.x, d.x) && in.eqClass.equivalent(emitted.y, d.y)) {
-        return true;
-      }
+bool LocalFCP::isEmitted(const DeltaPointToGraph &d, DUGNodeId node) {
+  auto& in = *nodeIn[node];
+  auto ite = emittedDiff.find(node);
+  if(ite == emittedDiff.end()) {
+    return false;
+  }
+  // Leaders only change when classes are merged. After merges, the recorded leaders are brought
+  // up to date (at most once per merge count), so that the lookup is exact.
+  EmittedDeltas& emitted = ite->second;
+  if(emitted.numMerges != in.getNumMerges()) {
+    DeltaSet canonical;
+    for(const auto& delta : emitted.deltas) {
+      canonical.insert(DeltaPointToGraph(delta.type, in.find(delta.x), in.find(delta.y)));
     }
+    emitted.deltas = std::move(canonical);
+    emitted.numMerges = in.getNumMerges();
   }
-  return false;
+  return emitted.deltas.count(DeltaPointToGraph(d.type, in.find(d.x), in.find(d.y))) > 0;
 }
 
 void LocalFCP::countStats() {
@@ -658,6 +1038,13 @@ void LocalFCP::countStats() {
   errs() << "Number of DUGNodes in total: |V| = " << numNodes << "\n";
   errs() << "Number of DUGEdges: " << numEdges
          << string_format(" ( = |V|^%.3f )\n", log(numEdges)/log(numNodes) );
+  errs() << "DUG simplification: |V| " << numNodesBeforeSimplify << " -> " << numNodes
+         << ", |E| " << numEdgesBeforeSimplify << " -> " << numEdges << "\n";
+  errs() << "\tRemoved pass-through nodes: " << numPassThroughRemoved << "\n";
+  errs() << "\tRemoved single-input fake PHI: " << numFakePhiRemoved << "\n";
+  errs() << "Worklist strategy: " << DUGWorklist::getStrategyName(worklist.getStrategy()) << "\n";
+  errs() << "Number of node visits in iterations: " << numNodeVisits
+         << string_format(" ( %.2f per node )\n", (double)numNodeVisits / numNodes);
   errs() << "Number of messages passed in iterations:" << numMsgPassed
          << string_format(" ( = |V|^%.3f )\n", log(numMsgPassed)/log(numNodes) );
   errs() << "Number of messages passed for globals: " << numMsgPassedForGlobals
@@ -665,41 +1052,288 @@ void LocalFCP::countStats() {
 }
 
 
-PointToGraph::PointToGraph() {
+DUGWorklist::DUGWorklist(Strategy strategy) : strategy(strategy), numPending(0), numPrioritized(0) {
+
+}
+
+void DUGWorklist::resize(unsigned numNodes) {
+  inList.resize(numNodes);
+  priority.resize(numNodes, UINT_MAX);
+}
+
+bool DUGWorklist::push(DUGNodeId node) {
+  if(inList.test(node)) {
+    return false;
+  }
+  inList.set(node);
+  numPending += 1;
+  switch(strategy) {
+    case FIFO:
+    case LIFO:
+      queue.push_back(node);
+      break;
+    case RPO:
+      heap.push(PrioritizedNode(getPriority(node), node));
+      break;
+    case Wavefront:
+      nextWave.push_back(PrioritizedNode(getPriority(node), node));
+      break;
+  }
+  return true;
+}
+
+DUGNodeId DUGWorklist::pop() {
+  assert(!empty() && "Popping from an empty worklist");
+  DUGNodeId node = 0;
+  switch(strategy) {
+    case FIFO:
+      node = queue.front();
+      queue.pop_front();
+      break;
+    case LIFO:
+      node = queue.back();
+      queue.pop_back();
+      break;
+    case Wavefront:
+      if(heap.empty()) {
+        // The current sweep is finished. Start the next one.
+        for(const auto& pn : nextWave) {
+          heap.push(pn);
+        }
+        nextWave.clear();
+      }
+      // Fall through
+    case RPO:
+      node = heap.top().second;
+      assert(heap.top().first == getPriority(node) && "Node queued before its priority was set");
+      heap.pop();
+      break;
+  }
+  inList.reset(node);
+  numPending -= 1;
+  return node;
+}
+
+void DUGWorklist::reset(Strategy newStrategy) {
+  strategy = newStrategy;
+  inList.clear();
+  numPending = 0;
+  priority.clear();
+  numPrioritized = 0;
+  queue.clear();
+  heap = NodeHeap();
+  nextWave.clear();
+}
+
+const char* DUGWorklist::getStrategyName(Strategy s) {
+  switch(s) {
+    case FIFO:
+      return "fifo";
+    case LIFO:
+      return "lifo";
+    case RPO:
+      return "rpo";
+    case Wavefront:
+      return "wavefront";
+  }
+  return "<unknown>";
+}
+
+PointToGraph::PointToGraph(ResourceNumbering *numbering)
+    : numbering(numbering), pointTo(NoResource), fieldHolder(NoResource) {
   valPointTo = nullptr;
 }
 
 Value* PointToGraph::getPointTo(Value *v) {
-  Value *f = eqClass.find(v);
-  if(pointTo.count(f) > 0) {
-    return pointTo[f];
-  } else {
+  ResourceId id = numbering->lookup(v);
+  if(id == NoResource) {
     return nullptr;
   }
+  return numbering->getValue(pointTo.get(eqClass.find(id)));
 }
 
 Value* PointToGraph::setPointTo(Value *v, Value* to) {
-  Value *f = eqClass.find(v);
-  return pointTo[f] = to;
+  ResourceId f = eqClass.find(numbering->getId(v));
+  pointTo.set(f, to == nullptr ? NoResource : numbering->getId(to));
+  return to;
+}
+
+// The member whose fields stand for the fields of the class led by 'leader', or NoResource.
+static ResourceId getFieldHolder(PointToGraph& g, ResourceId leader) {
+  ResourceId holder = g.fieldHolder.get(leader);
+  if(holder != NoResource) {
+    return holder;
+  }
+  return g.numbering->getFields(leader) != nullptr ? leader : NoResource;
+}
+
+Value* PointToGraph::getField(Value *v, unsigned offset) {
+  ResourceId id = numbering->lookup(v);
+  if(id == NoResource || !numbering->hasFields()) {
+    return v;
+  }
+  ResourceId holder = getFieldHolder(*this, eqClass.find(id));
+  if(holder == NoResource) {
+    return v;
+  }
+  for(const auto& field : *numbering->getFields(holder)) {
+    if(field.first == offset) {
+      return numbering->getValue(field.second);
+    }
+  }
+  return v;
+}
+
+Value* PointToGraph::find(Value *v) {
+  ResourceId id = numbering->lookup(v);
+  if(id == NoResource) {
+    return v;
+  }
+  return numbering->getValue(eqClass.find(id));
+}
+
+bool PointToGraph::equivalent(Value *x, Value *y) {
+  return find(x) == find(y);
+}
+
+int PointToGraph::getRank(Value *v) {
+  ResourceId id = numbering->lookup(v);
+  return id == NoResource ? 0 : eqClass.getRank(id);
+}
+
+std::vector<Value*> PointToGraph::getClassMembers(Value *v) {
+  std::vector<Value*> members(1, v);
+  ResourceId id = numbering->lookup(v);
+  if(id == NoResource) {
+    return members;
+  }
+  for(ResourceId m = eqClass.getNext(id); m != id; m = eqClass.getNext(m)) {
+    members.push_back(numbering->getValue(m));
+  }
+  return members;
 }
 
 Value* PointToGraph::unspecificSpace = (Value*)1;
 
-char* const PointToGraph::externalPlaceholderBase = (char* const)1024;
-char* const PointToGraph::externalPlaceholderTop = (char* const)(0x8048000);
-char* PointToGraph::externalPlaceholderCurrent = (char*)1024;
-Value* PointToGraph::getFreshExternalPlaceholder() {
-  Value* ret = (Value*) (externalPlaceholderCurrent++);
-  if(externalPlaceholderCurrent >= externalPlaceholderTop) {
-    errs() << "Fake pointers address space wrapped!\n";
-    externalPlaceholderCurrent = externalPlaceholderBase;
+static_assert(sizeof(Value*) == sizeof(uint64_t), "placeholders are tagged 64-bit ids");
+
+static const uint64_t PlaceholderTag = (uint64_t)1 << 63;
+static const uint32_t MaxArena = ((uint64_t)1 << 31) - 1;
+
+std::atomic<uint32_t> PlaceholderArena::nextArena(0);
+
+PlaceholderArena::PlaceholderArena() {
+  reset();
+}
+
+PlaceholderArena::PlaceholderArena(PlaceholderArena&& other) noexcept
+    : arena(other.arena), count(other.count), real(std::move(other.real)) {
+  other.reset();
+}
+
+PlaceholderArena& PlaceholderArena::operator=(PlaceholderArena&& other) noexcept {
+  arena = other.arena;
+  count = other.count;
+  real = std::move(other.real);
+  other.reset();
+  return *this;
+}
+
+Value* PlaceholderArena::fresh(Value *real) {
+  // Checked in release builds too: a wrapped index would alias an earlier placeholder.
+  if(count == UINT32_MAX) {
+    report_fatal_error("Placeholder arena exhausted");
+  }
+  uint32_t index = count++;
+  if(real != nullptr) {
+    if(this->real.size() <= index) {
+      this->real.resize(index + 1, nullptr);
+    }
+    this->real[index] = real;
+  }
+  return (Value*)(PlaceholderTag | ((uint64_t)arena << 32) | index);
+}
+
+Value* PlaceholderArena::getReal(Value *p) const {
+  if(!isPlaceholder(p) || arenaOf(p) != arena || indexOf(p) >= real.size()) {
+    return nullptr;
+  }
+  return real[indexOf(p)];
+}
+
+void PlaceholderArena::release() {
+  std::vector<Value*>().swap(real);
+}
+
+void PlaceholderArena::reset() {
+  // SCCs may be analyzed concurrently (see BuFCP), so arenas are numbered atomically.
+  arena = nextArena++;
+  if(arena > MaxArena) {
+    report_fatal_error("Too many placeholder arenas");
+  }
+  count = 0;
+  release();
+}
+
+bool PlaceholderArena::isPlaceholder(Value *v) {
+  return ((uint64_t)v & PlaceholderTag) != 0;
+}
+
+uint32_t PlaceholderArena::arenaOf(Value *v) {
+  return (uint32_t)(((uint64_t)v & ~PlaceholderTag) >> 32);
+}
+
+uint32_t PlaceholderArena::indexOf(Value *v) {
+  return (uint32_t)(uint64_t)v;
+}
+
+bool CompactPointToGraph::isInterfaceValue(Value *v) {
+  if(v == PointToGraph::unspecificSpace || PointToGraph::isFakeValue(v)) {
+    return false;
+  }
+  return dyn_cast<Argument>(v) != nullptr || dyn_cast<GlobalVariable>(v) != nullptr;
+}
+
+CompactPointToGraph CompactPointToGraph::build(PointToGraph& g) {
+  CompactPointToGraph compact;
+  compact.valPointTo = g.valPointTo;
+
+  // Number the classes reachable from the interface by a BFS along the point-to links.
+  std::unordered_map<Value*, int> classOf;
+  std::vector<Value*> leaders;
+  auto reach = [&](Value *v) -> int {
+    Value *leader = g.find(v);
+    auto ite = classOf.find(leader);
+    if(ite != classOf.end()) {
+      return ite->second;
+    }
+    int c = leaders.size();
+    classOf[leader] = c;
+    leaders.push_back(leader);
+    return c;
+  };
+
+  for(ResourceId id = 0; id < g.size(); id++) {
+    Value *v = g.valueOf(id);
+    // Singletons pointing to nothing carry no information.
+    if(isInterfaceValue(v) && (g.eqClass.getNext(id) != id || g.getPointTo(v) != nullptr)) {
+      reach(v);
+    }
+  }
+  if(g.valPointTo != nullptr) {
+    reach(g.valPointTo);
   }
-  return ret;
+
+  for(unsigned c = 0; c < leaders.size(); c++) {
+    compact.members.push_back(g.getClassMembers(leaders[c]));
+    Value *to = g.getPointTo(leaders[c]);
+    compact.pointTo.push_back(to == nullptr ? -1 : reach(to));
+  }
+  return compact;
 }
 
 bool PointToGraph::isFakeValue(Value *v) {
-  char *addr = (char*) v;
-  return (addr >= externalPlaceholderBase && addr < externalPlaceholderTop);
+  return PlaceholderArena::isPlaceholder(v);
 }
 
 
@@ -709,13 +1343,100 @@ DeltaPointToGraph llvm::make_pointTo(Value* x, Value *y) {
   return DeltaPointToGraph(DeltaPointToGraph::Type::PointTo, x, y);
 }
 
+void llvm::compactDeltas(std::vector<DeltaPointToGraph>& deltas) {
+  if(deltas.empty()) {
+    return;
+  }
+  auto isMerge = [](const DeltaPointToGraph& d) {
+    return d.type == DeltaPointToGraph::Type::Merge;
+  };
+  // A merge is kept in the order Values are compared in, so merges in either order are equal.
+  auto normalize = [&](DeltaPointToGraph d) {
+    if(isMerge(d) && std::less<Value*>()(d.y, d.x)) {
+      std::swap(d.x, d.y);
+    }
+    return d;
+  };
+
+  size_t kept = 0;
+  if(deltas.size() <= 8) {
+    // Small batches (the common case) are compared pairwise.
+    for(size_t i = 0; i < deltas.size(); i++) {
+      DeltaPointToGraph d = normalize(deltas[i]);
+      bool redundant = isMerge(d) && d.x == d.y;
+      for(size_t j = 0; j < kept && !redundant; j++) {
+        redundant = normalize(deltas[j]) == d;
+      }
+      if(!redundant) {
+        deltas[kept++] = deltas[i];
+      }
+    }
+  } else {
+    DeltaSet seen;
+    for(size_t i = 0; i < deltas.size(); i++) {
+      DeltaPointToGraph d = normalize(deltas[i]);
+      if((isMerge(d) && d.x == d.y) || !seen.insert(d).second) {
+        continue;
+      }
+      deltas[kept++] = deltas[i];
+    }
+  }
+  deltas.erase(deltas.begin() + kept, deltas.end());
+}
+
 DeltaPointToGraph llvm::make_merge(Value* x, Value *y) {
   return DeltaPointToGraph(DeltaPointToGraph::Type::Merge, x, y);
 }
 
+bool LocalFCP::isFieldSensitive() {
+  return FieldSensitive;
+}
+
+void LocalFCP::identifyFields(Function &F, LocalMemSSA *memSSA) {
+  if(!FieldSensitive) {
+    return;
+  }
+  for(inst_iterator I = inst_begin(F); I != inst_end(F); I++) {
+    auto alloca = dyn_cast<AllocaInst>(&*I);
+    if(alloca == nullptr) {
+      continue;
+    }
+    ResourceNumbering::FieldList fields;
+    for(unsigned offset : memSSA->getFieldOffsets(alloca)) {
+      Value *field = placeholders.fresh();
+      resources.insert(field);
+      fieldBase[field] = alloca;
+      fields.push_back(std::make_pair(offset, numbering->getId(field)));
+    }
+    if(!fields.empty()) {
+      numbering->setFields(numbering->getId(alloca), std::move(fields));
+    }
+  }
+}
+
+Value* LocalFCP::getMemLocation(PointToGraph& in, Value *ptr, Instruction *inst) {
+  Value *mem = getMemObjectsForVal(ptr);
+  if(mem == nullptr || fieldBase.empty()) {
+    return mem;
+  }
+  unsigned offset = nodeSSA.at(inst)->getFieldOffset(ptr);
+  return offset == 0 ? mem : in.getField(mem, offset);
+}
+
+bool LocalFCP::isStrongUpdatable(PointToGraph& in, Value *loc) {
+  if(in.getRank(loc) != 0) {
+    return false;
+  }
+  // A field is a single memory object only if the object it belongs to is.
+  auto ite = fieldBase.find(loc);
+  return ite == fieldBase.end() || in.getRank(ite->second) == 0;
+}
+
 Value* LocalFCP::getMemObjectsForVal(Value *x) {
   if(resources.count(x) > 0) {
     return x;
+  } else if(passThrough.count(x) > 0) {
+    return getMemObjectsForVal(passThrough[x]);
   } else if(auto inst = dyn_cast<Instruction>(x)) {
     if(DUGNodes.count(inst) > 0) {
       return dataIn[inst].valPointTo;
@@ -733,10 +1454,66 @@ Value* LocalFCP::getMemObjectsForVal(Value *x) {
   return nullptr;
 }
 
+Instruction* LocalFCP::getDUGNodeForVal(Value *x) {
+  while(passThrough.count(x) > 0) {
+    x = passThrough[x];
+  }
+  auto inst = dyn_cast<Instruction>(x);
+  if(inst != nullptr && DUGNodes.count(inst) > 0) {
+    return inst;
+  }
+  return nullptr;
+}
+
+void LocalFCP::restrictToSlice(const std::vector<Instruction*>& seeds) {
+  // The result of a node only depends on the nodes reaching it by def-use edges, except that
+  // the merge points of a callsite are filled when the callee's summary is instantiated there.
+  std::unordered_map<Instruction*, Instruction*> mergePointCall;
+  std::unordered_set<LocalMemSSA*> memSSAs;
+  for(const auto& kv : nodeSSA) {
+    memSSAs.insert(kv.second);
+  }
+  for(auto memSSA : memSSAs) {
+    for(const auto& call_phis : memSSA->callRetMemMergePoints) {
+      for(const auto& n_phi : call_phis.second) {
+        mergePointCall[n_phi.second] = call_phis.first;
+      }
+    }
+  }
+
+  sliced = true;
+  slice.clear();
+  std::vector<Instruction*> stack;
+  for(auto seed : seeds) {
+    if(slice.insert(seed).second) {
+      stack.push_back(seed);
+    }
+  }
+  while(!stack.empty()) {
+    Instruction *inst = stack.back();
+    stack.pop_back();
+    auto callIte = mergePointCall.find(inst);
+    if(callIte != mergePointCall.end() && slice.insert(callIte->second).second) {
+      stack.push_back(callIte->second);
+    }
+    auto ite = usedefEdges.find(inst);
+    if(ite == usedefEdges.end()) {
+      continue;
+    }
+    for(auto def : ite->second) {
+      if(slice.insert(def).second) {
+        stack.push_back(def);
+      }
+    }
+  }
+}
+
 std::unordered_set<Value*> LocalFCP::getPointToSetForVal(Value *x) {
   std::unordered_set<Value*> s;
   if(resources.count(x) > 0) {
     s.insert(x);
+  } else if(passThrough.count(x) > 0) {
+    s = getPointToSetForVal(passThrough[x]);
   } else if(auto inst = dyn_cast<Instruction>(x)) {
     if(DUGNodes.count(inst) > 0) {
       s = dataIn[inst].valPointToSets;
@@ -749,8 +1526,9 @@ std::unordered_set<Value*> LocalFCP::getPointToSetForVal(Value *x) {
 void PointToGraph::mergeUnnamedRec(Value *x) {
   std::unordered_set<Value*> visited;
   do {
-    if(eqClass.getRank(x) == 0) {
-      eqClass.rank[eqClass.find(x)] = 1;
+    ResourceId id = numbering->getId(x);
+    if(eqClass.getRank(id) == 0) {
+      eqClass.setRank(id, 1);
     }
     visited.insert(x);
     x = getPointTo(x);
@@ -770,14 +1548,41 @@ bool PointToGraph::mergeRec(Value *x, Value *y) {
 
   Value *px = getPointTo(x);
   Value *py = getPointTo(y);
-  bool activated = eqClass.merge(x, y);
+  ResourceId ix = numbering->getId(x);
+  ResourceId iy = numbering->getId(y);
+  ResourceId hx = NoResource, hy = NoResource;
+  if(numbering->hasFields()) {
+    hx = getFieldHolder(*this, eqClass.find(ix));
+    hy = getFieldHolder(*this, eqClass.find(iy));
+  }
+  bool activated = eqClass.merge(ix, iy);
   if(activated) {
+    if(hx != NoResource || hy != NoResource) {
+      fieldHolder.set(eqClass.find(ix), hx != NoResource ? hx : hy);
+    }
     mergeRec(px, py);
     if(px != nullptr) {
       setPointTo(x, px);
     } else if(py != nullptr) {
       setPointTo(x, py);
     }
+    if(hx != NoResource && hy != NoResource) {
+      // Both classes have fields: keep those at the same offset together. Objects of a class
+      // share their DSNode, hence their offsets.
+      const auto& fx = *numbering->getFields(hx);
+      const auto& fy = *numbering->getFields(hy);
+      for(unsigned i = 0, j = 0; i < fx.size() && j < fy.size(); ) {
+        if(fx[i].first < fy[j].first) {
+          i++;
+        } else if(fx[i].first > fy[j].first) {
+          j++;
+        } else {
+          mergeRec(numbering->getValue(fx[i].second), numbering->getValue(fy[j].second));
+          i++;
+          j++;
+        }
+      }
+    }
   }
   return activated;
 }
@@ -790,7 +1595,7 @@ std::string PointToGraph::escape(Value* v) {
   } else if(v == unspecificSpace) {
     rso << "<unspecific space>";
   } else if(PointToGraph::isFakeValue(v)) {
-    rso << "<external " << ((char*)v - (char*)externalPlaceholderBase) << ">";
+    rso << "<external " << PlaceholderArena::arenaOf(v) << "." << PlaceholderArena::indexOf(v) << ">";
   } else {
     v->print(rso);
   }
@@ -802,8 +1607,7 @@ void LocalFCP::initWorkListDomOrder(LocalMemSSA *memSSA, BasicBlock *bb, std::un
   for(auto& n_phi : memSSA->phiNodes[bb]) {
     PHINode *phi = n_phi.second;
     if(DUGNodes.count(phi) > 0) {
-      worklist.push(phi);
-      inList.insert(phi);
+      pushNode(phi);
     }
   }
   for(auto& I : *bb) {
@@ -811,14 +1615,12 @@ void LocalFCP::initWorkListDomOrder(LocalMemSSA *memSSA, BasicBlock *bb, std::un
     if(auto call = dyn_cast<CallInst>(inst)) {
       if(memSSA->callRetMemMergePoints.count(call) > 0) {
         for(const auto& np : memSSA->callRetMemMergePoints[call]) {
-          worklist.push(np.second);
-          inList.insert(np.second);
+          pushNode(np.second);
         }
       }
     }
     if(DUGNodes.count(inst) > 0) {
-      worklist.push(inst);
-      inList.insert(inst);
+      pushNode(inst);
     }
   }
   for(auto succ: successors(bb)) {
@@ -836,12 +1638,22 @@ Value* LocalFCP::getImplicitArgOf(Value *x) {
   //      elements of 'x'.
   //   2. Modify mergeRec() for the case of one argument is nullptr.
   if(implicitArgsPointedBy.count(x) == 0) {
-    implicitArgsPointedBy[x] = PointToGraph::getFreshExternalPlaceholder();
+    implicitArgsPointedBy[x] = placeholders.fresh();
     externalResources.insert(implicitArgsPointedBy[x]);
   }
   return implicitArgsPointedBy[x];
 }
 
+void LocalFCP::buildInterfaceGraphs(const std::vector<Instruction*>& insts) {
+  interfaceGraphs.clear();
+  for(auto inst : insts) {
+    auto ite = dataIn.find(inst);
+    if(ite != dataIn.end()) {
+      interfaceGraphs[inst] = CompactPointToGraph::build(ite->second);
+    }
+  }
+}
+
 void LocalFCP::generateSummary() {
   // Merge all ReturnInst into a single summary.
 
@@ -860,15 +1672,22 @@ void LocalFCP::generateSummary() {
 
   for(int i = 1; i < retInsts.size(); i++) {
     const auto& ptg = dataOut[retInsts[i]];
-    for(auto kv : ptg.eqClass.leader) {
-      summary.mergeRec(kv.first, kv.second);
+    for(ResourceId id = 0; id < ptg.eqClass.size(); id++) {
+      if(!ptg.eqClass.isRoot(id)) {
+        summary.mergeRec(ptg.valueOf(id), ptg.valueOf(ptg.eqClass.getParent(id)));
+      }
     }
-    for(auto kv : ptg.pointTo) {
-      auto ptrTo = summary.getPointTo(kv.first);
+    for(ResourceId id = 0; id < ptg.pointTo.size(); id++) {
+      if(ptg.pointTo.get(id) == NoResource) {
+        continue;
+      }
+      Value *from = ptg.valueOf(id);
+      Value *to = ptg.valueOf(ptg.pointTo.get(id));
+      auto ptrTo = summary.getPointTo(from);
       if(ptrTo == nullptr) {
-        summary.setPointTo(kv.first, kv.second);
+        summary.setPointTo(from, to);
       } else {
-        summary.mergeRec(kv.second, ptrTo);
+        summary.mergeRec(to, ptrTo);
       }
     }
     summary.mergeRec(summary.valPointTo, ptg.valPointTo);
@@ -5,9 +5,11 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/Support/CommandLine.h"
 #include "dsa/DSGraph.h"
 
 #include "flowuni/MemSSA.h"
+#include "flowuni/Profile.h"
 
 #include <set>
 #include <map>
@@ -19,6 +21,10 @@ using namespace llvm;
 
 namespace{
   static RegisterPass<LocalMemSSAWrapper> X("localMemSSA", "Intraprocedural memory SSA based on Data Structure Analysis", true, true);
+
+  static cl::opt<bool> PrunedSSA("flowuni-pruned-ssa",
+         cl::desc("Only place fake PHINodes where the memory object is live"),
+         cl::init(true));
 }
 
 
@@ -32,7 +38,6 @@ void LocalMemSSAWrapper::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.setPreservesAll();
   AU.addRequired<LocalDataStructures>();
   AU.addRequired<EquivBUDataStructures>();
-  AU.addRequired<DominanceFrontier>();
   AU.addRequired<DominatorTreeWrapperPass>();
 }
 
@@ -40,48 +45,152 @@ bool LocalMemSSAWrapper::runOnModule(Module &M) {
 
 // #define __DBG_MEMSSA
 
+  DataStructures *dsa = &getAnalysis<EquivBUDataStructures>();
 #ifdef __DBG_MEMSSA
-  localMemSSA.dsa = &getAnalysis<EquivBUDataStructures>();
-  localMemSSA.dsa->print(errs(), &M);
+  dsa->print(errs(), &M);
 #endif
   for(auto& F: M) {
     if(F.isDeclaration() == false) {
+      // Build the SSA in place: LocalMemSSA owns its fake PHINodes and is never copied.
+      LocalMemSSA& localMemSSA = ssa.emplace(&F, LocalMemSSA()).first->second;
       localMemSSA.func = &F;
-      localMemSSA.dsa = &getAnalysis<EquivBUDataStructures>();
-      localMemSSA.dsgraph = localMemSSA.dsa->getDSGraph(F);
-      localMemSSA.domFrontiers = &getAnalysis<DominanceFrontier>(F);
+      localMemSSA.dsa = dsa;
+      localMemSSA.dsgraph = dsa->getDSGraph(F);
       localMemSSA.domTree = &(getAnalysis<DominatorTreeWrapperPass>(F).getDomTree());
 
+      Profiler::Scope profile("memssa", Profiler::Module, F.getName().str());
       localMemSSA.runOnFunction(F);
-      ssa[&F] = localMemSSA;
     }
   }
   return false;
 }
 
 namespace {
-  void traverse(DSNode *n, std::set<DSNode*>& reached);
-  std::set<DSNode*> reachableDSNodes(DSNode *n);
+  // Iterated dominance frontiers, computed by walking the dominator tree from the deepest
+  // definition upwards (Sreedhar & Gao). Each block is visited at most once per computation,
+  // instead of closing the dominance frontiers of PHINodes until a fixpoint.
+  struct IDFCalculator {
+    explicit IDFCalculator(DominatorTree *domTree) : domTree(domTree) {
+      // Depth of each node in the dominator tree.
+      std::vector<DomTreeNode*> worklist;
+      if(DomTreeNode *root = domTree->getRootNode()) {
+        levels[root] = 0;
+        worklist.push_back(root);
+      }
+      while(!worklist.empty()) {
+        DomTreeNode *node = worklist.back();
+        worklist.pop_back();
+        for(auto child : node->getChildren()) {
+          levels[child] = levels[node] + 1;
+          worklist.push_back(child);
+        }
+      }
+    }
+
+    // Blocks in the iterated dominance frontier of 'defBlocks'. If 'liveIn' is given, only
+    // blocks in it are returned (i.e. the placement of a pruned SSA form).
+    std::vector<BasicBlock*> calculate(const std::set<BasicBlock*>& defBlocks,
+                                       const std::unordered_set<BasicBlock*> *liveIn) {
+      typedef std::pair<unsigned, DomTreeNode*> LeveledNode;
+      std::priority_queue<LeveledNode> pq;   // Deepest first.
+      for(auto bb : defBlocks) {
+        if(DomTreeNode *node = domTree->getNode(bb)) {
+          pq.push(std::make_pair(levels[node], node));
+        }
+      }
+
+      std::vector<BasicBlock*> idf;
+      std::unordered_set<DomTreeNode*> visitedPQ, visitedWorklist;
+      std::vector<DomTreeNode*> worklist;
+      while(!pq.empty()) {
+        unsigned rootLevel = pq.top().first;
+        DomTreeNode *root = pq.top().second;
+        pq.pop();
+
+        // Visit the dominator subtree of 'root'; a CFG edge leaving it to a block not deeper than
+        // 'root' reaches the dominance frontier.
+        worklist.push_back(root);
+        visitedWorklist.insert(root);
+        while(!worklist.empty()) {
+          DomTreeNode *node = worklist.back();
+          worklist.pop_back();
+          for(BasicBlock *succ : successors(node->getBlock())) {
+            DomTreeNode *succNode = domTree->getNode(succ);
+            if(succNode == nullptr || succNode->getIDom() == node) {
+              continue;
+            }
+            unsigned succLevel = levels[succNode];
+            if(succLevel > rootLevel || not visitedPQ.insert(succNode).second) {
+              continue;
+            }
+            if(liveIn && liveIn->count(succ) == 0) {
+              continue;
+            }
+            idf.push_back(succ);
+            if(defBlocks.count(succ) == 0) {
+              pq.push(std::make_pair(succLevel, succNode));
+            }
+          }
+          for(auto child : node->getChildren()) {
+            if(visitedWorklist.insert(child).second) {
+              worklist.push_back(child);
+            }
+          }
+        }
+      }
+      return idf;
+    }
+
+  private:
+    DominatorTree *domTree;
+    std::unordered_map<DomTreeNode*, unsigned> levels;
+  };
+
+  // Blocks where a memory object is live on entry. Every definition of a memory object also
+  // reads its previous definition, so it is live-in exactly in the blocks reaching a use.
+  std::unordered_set<BasicBlock*> liveInBlocks(const std::set<BasicBlock*>& useBlocks) {
+    std::unordered_set<BasicBlock*> live(useBlocks.begin(), useBlocks.end());
+    std::vector<BasicBlock*> worklist(useBlocks.begin(), useBlocks.end());
+    while(!worklist.empty()) {
+      BasicBlock *bb = worklist.back();
+      worklist.pop_back();
+      for(BasicBlock *pred : predecessors(bb)) {
+        if(live.insert(pred).second) {
+          worklist.push_back(pred);
+        }
+      }
+    }
+    return live;
+  }
+}
 
-  // Helper function to find all DSNode-s reachable from 'n' in 'g'
-  std::set<DSNode*> reachableDSNodes(DSNode *n) {
-    std::set<DSNode*> reachable;
-    traverse(n, reachable);
-    return reachable;
+// All DSNode-s reachable from 'n' (including 'n'). Results are memoized per function.
+const std::vector<DSNode*>& LocalMemSSA::reachableDSNodes(DSNode *n) {
+  auto ite = reachableCache.find(n);
+  if(ite != reachableCache.end()) {
+    return ite->second;
   }
 
-  void traverse(DSNode *n, std::set<DSNode*>& reached) {
-    reached.insert(n);
-    for(auto edge_ite = n->edge_begin(); edge_ite != n->edge_end(); edge_ite++) {
+  std::vector<DSNode*> reachable;
+  std::unordered_set<DSNode*> reached;
+  std::vector<DSNode*> worklist;
+  reached.insert(n);
+  worklist.push_back(n);
+  while(!worklist.empty()) {
+    DSNode *m = worklist.back();
+    worklist.pop_back();
+    reachable.push_back(m);
+    for(auto edge_ite = m->edge_begin(); edge_ite != m->edge_end(); edge_ite++) {
       DSNodeHandle h = edge_ite->second;
       if(!h.isNull()) {
         DSNode *t = h.getNode();
-        if(reached.count(t) == 0) {
-          traverse(t, reached);
+        if(reached.insert(t).second) {
+          worklist.push_back(t);
         }
       }
     }
   }
+  return reachableCache[n] = std::move(reachable);
 }
 
 void LocalMemSSA::clear() {
@@ -97,6 +206,14 @@ void LocalMemSSA::clear() {
   callArgLastDef.clear();
   returnedMem.clear();
   retMemLastDef.clear();
+  reachableCache.clear();
+  fieldSensitive.clear();
+  fakePhis.clear();
+}
+
+PHINode* LocalMemSSA::createFakePhi() {
+  fakePhis.emplace_back(PHINode::Create(Type::getVoidTy(func->getContext()), 0, ""));
+  return fakePhis.back().get();
 }
 
 DSNode* LocalMemSSA::GlobalsLeader = (DSNode*) "virtual DSNode for globals";
@@ -114,7 +231,7 @@ bool LocalMemSSA::runOnFunction(Function &F) {
     if (node_ite->isGlobalNode()) {
       globals.insert(&*node_ite);
 
-      auto reachable = reachableDSNodes(&*node_ite);
+      const auto& reachable = reachableDSNodes(&*node_ite);
       for(DSNode* m: reachable) {
         globals.insert(m);
       }
@@ -129,12 +246,17 @@ bool LocalMemSSA::runOnFunction(Function &F) {
   // For each load/store instruction, build an SSA form from the results of DSA.
 
   // Step1. place all necessary PHINodes for memory objects
+
+  // Blocks defining/using each memory object. A definition (store, alloca, call) also reads the
+  // previous definition, so it is a use as well.
+  std::map<DSNode*, std::set<BasicBlock*>> defBlocks, useBlocks;
+  std::vector<BasicBlock*> retBlocks;
+
   for(auto bb_ite = F.begin(); bb_ite != F.end(); bb_ite++) {
-    const std::set<BasicBlock*> &frontiers = domFrontiers->find(&*bb_ite)->second;
+    BasicBlock *bb = &*bb_ite;
 
     for(auto inst_ite = bb_ite->begin(); inst_ite != bb_ite->end(); inst_ite++) {
       if(StoreInst* store = dyn_cast<StoreInst>(&*inst_ite)) {
-        // If a StoreInst modify a memory object aliasing our 'resources', insert a PHINode at the dominance frontier.
         Value* ptr = store->getPointerOperand();
         if(aliasResource(ptr)) {
           // this StoreInst modifies a memory object aliasing our 'resources'
@@ -145,11 +267,8 @@ bool LocalMemSSA::runOnFunction(Function &F) {
             n = GlobalsLeader;
           }
 
-          for(auto frontier : frontiers) {
-            if(phiNodes[frontier].count(n) == 0) {
-              phiNodes[frontier][n] = PHINode::Create( Type::getVoidTy(F.getContext()), 0, "");
-            }
-          }
+          defBlocks[n].insert(bb);
+          useBlocks[n].insert(bb);
         }
 
       } else if(AllocaInst* alloca = dyn_cast<AllocaInst>(&*inst_ite)) {
@@ -163,11 +282,20 @@ bool LocalMemSSA::runOnFunction(Function &F) {
             n = GlobalsLeader;
           }
 
-          for(auto frontier : frontiers) {
-            if(phiNodes[frontier].count(n) == 0) {
-              phiNodes[frontier][n] = PHINode::Create( Type::getVoidTy(F.getContext()), 0, "");
-            }
+          defBlocks[n].insert(bb);
+          useBlocks[n].insert(bb);
+        }
+      } else if(LoadInst* load = dyn_cast<LoadInst>(&*inst_ite)) {
+        Value *ptr = load->getPointerOperand();
+        if(aliasResource(ptr)) {
+          DSNode *n = dsgraph->getNodeForValue(ptr).getNode();
+
+          // We track all global DSNodes together so that we replace all of them with the static constant GlobalsLeader.
+          if(globals.count(n) > 0) {
+            n = GlobalsLeader;
           }
+
+          useBlocks[n].insert(bb);
         }
       } else if(CallInst* call = dyn_cast<CallInst>(&*inst_ite)) {
         // Function calls are treated modifying all resources reachable from their arguments.
@@ -179,8 +307,7 @@ bool LocalMemSSA::runOnFunction(Function &F) {
           Value *ptr = arg.get();
           if(dsgraph->hasNodeForValue(ptr)) {
             DSNode *n = dsgraph->getNodeForValue(ptr).getNode();
-            std::set<DSNode*> reachable = reachableDSNodes(n);
-            for(auto n : reachable) {
+            for(auto n : reachableDSNodes(n)) {
               if(memObjects.count(n) > 0) {
                 if(globals.count(n) > 0) {
                   continue;
@@ -193,9 +320,7 @@ bool LocalMemSSA::runOnFunction(Function &F) {
 
         if(dsgraph->hasNodeForValue(call)) {
           DSNode *n = dsgraph->getNodeForValue(call).getNode();
-          auto reachable = reachableDSNodes(n);
-
-          for (DSNode *n : reachable) {
+          for (DSNode *n : reachableDSNodes(n)) {
             if(globals.count(n) > 0) {
               continue;
             }
@@ -207,18 +332,15 @@ bool LocalMemSSA::runOnFunction(Function &F) {
         memModified.insert(GlobalsLeader);
 
         for(DSNode *n : memModified) {
-          for(auto frontier : frontiers) {
-            if(phiNodes[frontier].count(n) == 0) {
-              phiNodes[frontier][n] = PHINode::Create( Type::getVoidTy(F.getContext()), 0, "");
-            }
-          }
+          defBlocks[n].insert(bb);
+          useBlocks[n].insert(bb);
         }
       } else if(ReturnInst* ret = dyn_cast<ReturnInst>(&*inst_ite)) {
+        retBlocks.push_back(bb);
         if(Value *retPtr = ret->getReturnValue()) {
           if(dsgraph->hasNodeForValue(retPtr)) {
             DSNode *n = dsgraph->getNodeForValue(retPtr).getNode();
-            auto reachable = reachableDSNodes(n);
-            for(DSNode *n : reachable) {
+            for(DSNode *n : reachableDSNodes(n)) {
               if(globals.count(n) == 0) {
                 returnedMem.insert(n);
               }
@@ -229,47 +351,11 @@ bool LocalMemSSA::runOnFunction(Function &F) {
     }
   }
 
-  // Add PHINode for PHINode inserted earlier until the PHINode set is closed...
-  std::queue<BasicBlock*> bbWithNewPHI;
-  std::set<BasicBlock*> inQueue;
-  for(const auto& kv : phiNodes) {
-    bbWithNewPHI.push(kv.first);
-    inQueue.insert(kv.first);
-  }
-  while(!bbWithNewPHI.empty()) {
-    BasicBlock* bb = bbWithNewPHI.front();
-    bbWithNewPHI.pop();
-    inQueue.erase(bb);
-
-    auto& bbPHIS = phiNodes[bb];
-    const auto& frontiers = domFrontiers->find(bb)->second;
-
-    for(auto n_p : bbPHIS) {
-      DSNode *n = n_p.first;
-      for(BasicBlock* frontier: frontiers) {
-        if(phiNodes[frontier].count(n) == 0) {
-          phiNodes[frontier][n] = PHINode::Create( Type::getVoidTy(F.getContext()), 0, "");
-          if(inQueue.count(frontier) == 0) {
-            inQueue.insert(frontier);
-            bbWithNewPHI.push(frontier);
-          }
-        }
-      }
-    }
-  }
-
-#ifdef __DBG_MEMSSA
-  errs() << "IR with PHI { \n";
-  errs() << F;
-  errs() <<"}\n";
-#endif
-
   // Identify explicit and implicit arguments and create merge points for them.
   for(auto& arg : F.args()) {
     if(dsgraph->hasNodeForValue(&arg)) {
       DSNode *n = dsgraph->getNodeForValue(&arg).getNode();
-      std::set<DSNode*> reachable = reachableDSNodes(n);
-      for(auto& i : reachable) {
+      for(auto& i : reachableDSNodes(n)) {
         // Globals are tracked separately with arguments.
         if(globals.count(n) == 0) {
           arguments.insert(i);
@@ -284,8 +370,40 @@ bool LocalMemSSA::runOnFunction(Function &F) {
     arguments.insert(GlobalsLeader);
   }
 
+  // Last definitions of arguments and returned memory are read when returning.
+  for(auto bb : retBlocks) {
+    for(DSNode *n : arguments) {
+      useBlocks[n].insert(bb);
+    }
+    for(DSNode *n : returnedMem) {
+      useBlocks[n].insert(bb);
+    }
+  }
+
+  identifyFieldSensitiveNodes(F);
+
+  // A memory object needs a PHINode in the iterated dominance frontier of its definitions,
+  // (when pruned) as long as it is live there.
+  IDFCalculator idf(domTree);
+  for(const auto& n_defs : defBlocks) {
+    DSNode *n = n_defs.first;
+    std::unordered_set<BasicBlock*> liveIn;
+    if(PrunedSSA) {
+      liveIn = liveInBlocks(useBlocks[n]);
+    }
+    for(BasicBlock *bb : idf.calculate(n_defs.second, PrunedSSA ? &liveIn : nullptr)) {
+      phiNodes[bb][n] = createFakePhi();
+    }
+  }
+
+#ifdef __DBG_MEMSSA
+  errs() << "IR with PHI { \n";
+  errs() << F;
+  errs() <<"}\n";
+#endif
+
   for(auto arg : arguments) {
-    argIncomingMergePoint[arg] = PHINode::Create( Type::getVoidTy(F.getContext()), 0, "");
+    argIncomingMergePoint[arg] = createFakePhi();
   }
 
   // Create merge points for returning from function calls.
@@ -293,7 +411,7 @@ bool LocalMemSSA::runOnFunction(Function &F) {
     if(auto call = dyn_cast<CallInst>(&*inst_ite)) {
       auto& retMergePoint = callRetMemMergePoints[call];
       for(DSNode *n : memModifiedByCall[call]) {
-        retMergePoint[n] = PHINode::Create( Type::getVoidTy(F.getContext()), 0, "");
+        retMergePoint[n] = createFakePhi();
       }
     }
   }
@@ -316,7 +434,8 @@ bool LocalMemSSA::runOnFunction(Function &F) {
     }
   }
 
-  dump();
+  // Only needed while building; release it instead of keeping it for every function.
+  std::unordered_map<DSNode*, std::vector<DSNode*>>().swap(reachableCache);
 
   return false;
 }
@@ -474,6 +593,67 @@ bool LocalMemSSA::aliasResource(Value* v) {
   }
 }
 
+void LocalMemSSA::identifyFieldSensitiveNodes(Function &F) {
+  std::unordered_set<DSNode*> escaping(arguments.begin(), arguments.end());
+  escaping.insert(globals.begin(), globals.end());
+  escaping.insert(returnedMem.begin(), returnedMem.end());
+  for(const auto& kv : memModifiedByCall) {
+    escaping.insert(kv.second.begin(), kv.second.end());
+  }
+
+  std::unordered_set<DSNode*> misaligned;
+  for(auto inst_ite = inst_begin(F); inst_ite != inst_end(F); inst_ite++) {
+    if(auto alloca = dyn_cast<AllocaInst>(&*inst_ite)) {
+      if(dsgraph->hasNodeForValue(alloca)) {
+        const DSNodeHandle& h = dsgraph->getNodeForValue(alloca);
+        if(h.getOffset() != 0) {
+          misaligned.insert(h.getNode());
+        } else if(h.getNode() != nullptr) {
+          fieldSensitive.insert(h.getNode());
+        }
+      }
+    }
+  }
+
+  for(auto ite = fieldSensitive.begin(); ite != fieldSensitive.end(); ) {
+    DSNode *n = *ite;
+    bool keep = escaping.count(n) == 0 && misaligned.count(n) == 0
+                && n->isAllocaNode() && !n->isHeapNode() && !n->isGlobalNode()
+                && !n->isCollapsedNode() && !n->isUnknownNode() && !n->isIncompleteNode()
+                && !n->isExternalNode() && !n->isIntToPtrNode() && !n->isPtrToIntNode();
+    if(keep) {
+      ite++;
+    } else {
+      ite = fieldSensitive.erase(ite);
+    }
+  }
+}
+
+unsigned LocalMemSSA::getFieldOffset(Value *ptr) {
+  if(fieldSensitive.empty() || !dsgraph->hasNodeForValue(ptr)) {
+    return 0;
+  }
+  const DSNodeHandle& h = dsgraph->getNodeForValue(ptr);
+  return fieldSensitive.count(h.getNode()) > 0 ? h.getOffset() : 0;
+}
+
+std::vector<unsigned> LocalMemSSA::getFieldOffsets(AllocaInst *alloca) {
+  std::vector<unsigned> offsets;
+  if(!dsgraph->hasNodeForValue(alloca)) {
+    return offsets;
+  }
+  DSNode *n = dsgraph->getNodeForValue(alloca).getNode();
+  if(fieldSensitive.count(n) == 0) {
+    return offsets;
+  }
+  for(auto edge_ite = n->edge_begin(); edge_ite != n->edge_end(); edge_ite++) {
+    if(edge_ite->first != 0) {
+      offsets.push_back(edge_ite->first);
+    }
+  }
+  return offsets;
+}
+
 // Remove our fake PhiNodes from the function
 void LocalMemSSA::hidePhiNodes() {
   for(const auto& kv : phiNodes) {
@@ -0,0 +1,137 @@
+//
+// Summaries of the functions exported by the modules of a project.
+//
+
+#include "flowuni/ModuleSummary.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+  // Bump when the format or the analysis changes.
+  const char *SummaryMagic = "flowuni-module-summary 2";
+}
+
+ModuleSummaries::Writer::Writer(Function *f) : writer(f) {
+
+}
+
+void ModuleSummaries::Writer::addRet(const CompactPointToGraph& g) {
+  writer.addGraph("ret", g);
+}
+
+void ModuleSummaries::Writer::addMemObject(const MemObjectPath& path, const CompactPointToGraph& g) {
+  writer.addGraph("mem " + path.str(), g);
+}
+
+std::string ModuleSummaries::Writer::str() const {
+  return writer.str();
+}
+
+void ModuleSummaries::add(const std::string& name, std::string text) {
+  texts[name] = std::move(text);
+}
+
+std::string ModuleSummaries::getKey(const std::string& name) const {
+  auto ite = texts.find(name);
+  if(ite == texts.end()) {
+    return "";
+  }
+  return hashSummaryText(ite->second);
+}
+
+const FunctionSummary* ModuleSummaries::lookup(Function *decl) {
+  auto ite = resolved.find(decl);
+  if(ite != resolved.end()) {
+    return ite->second.get();
+  }
+  auto textIte = texts.find(decl->getName());
+  std::unique_ptr<FunctionSummary> summary;
+  if(textIte != texts.end()) {
+    summary = resolve(decl, textIte->second);
+    if(summary == nullptr) {
+      errs() << "Corrupted summary of " << decl->getName() << " is ignored\n";
+    }
+  }
+  return (resolved[decl] = std::move(summary)).get();
+}
+
+void ModuleSummaries::forgetResolved() {
+  resolved.clear();
+}
+
+std::unique_ptr<FunctionSummary> ModuleSummaries::resolve(Function *decl, const std::string& text) {
+  std::unique_ptr<FunctionSummary> summary(new FunctionSummary());
+  SummaryReader reader(text, decl->getParent());
+  if(!reader.readValues(summary->placeholders)) {
+    return nullptr;
+  }
+  // Globals the module does not refer to are not named by it either.
+  for(Value *&v : reader.values) {
+    if(v == nullptr) {
+      v = summary->placeholders.fresh();
+    }
+  }
+
+  StringRef header;
+  while(reader.nextHeader(header)) {
+    if(header == "ret") {
+      summary->rets.emplace_back();
+      if(!reader.readGraph(summary->rets.back())) {
+        return nullptr;
+      }
+    } else if(header.startswith("mem ")) {
+      FunctionSummary::MemObject obj;
+      if(!MemObjectPath::parse(header.substr(4), obj.path) || !reader.readGraph(obj.graph)) {
+        return nullptr;
+      }
+      summary->memObjects.push_back(std::move(obj));
+    } else {
+      return nullptr;
+    }
+  }
+  return summary;
+}
+
+bool ModuleSummaries::write(const std::string& path, const std::vector<std::string>& names) const {
+  std::string text = std::string(SummaryMagic) + "\n";
+  for(const auto& name : names) {
+    auto ite = texts.find(name);
+    if(ite != texts.end()) {
+      text += "function " + name + "\n" + ite->second + "endfunction\n";
+    }
+  }
+  return writeSummaryFile(path, text);
+}
+
+bool ModuleSummaries::read(const std::string& path) {
+  std::unique_ptr<MemoryBuffer> buffer = readSummaryFile(path);
+  if(buffer == nullptr) {
+    return false;
+  }
+  StringRef line, rest = buffer->getBuffer();
+  std::tie(line, rest) = rest.split('\n');
+  if(line != SummaryMagic) {
+    return false;
+  }
+  while(!rest.empty()) {
+    std::tie(line, rest) = rest.split('\n');
+    if(!line.startswith("function ")) {
+      return false;
+    }
+    std::string name = line.substr(9);
+    std::string text;
+    while(true) {
+      if(rest.empty()) {
+        return false;
+      }
+      std::tie(line, rest) = rest.split('\n');
+      if(line == "endfunction") {
+        break;
+      }
+      text += line.str() + "\n";
+    }
+    texts[name] = std::move(text);
+  }
+  return true;
+}
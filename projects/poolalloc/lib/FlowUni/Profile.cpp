@@ -0,0 +1,225 @@
+//
+// Timing and counters of the phases of the FlowUni pipeline.
+//
+
+#include "flowuni/Profile.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+namespace {
+  // Write 's' as a JSON string.
+  struct Quoted {
+    const std::string& s;
+  };
+
+  raw_ostream& operator<<(raw_ostream& os, const Quoted& q) {
+    os << '"';
+    for(char c : q.s) {
+      if(c == '"' || c == '\\') {
+        os << '\\' << c;
+      } else if((unsigned char)c < 0x20) {
+        static const char *hex = "0123456789abcdef";
+        os << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+      } else {
+        os << c;
+      }
+    }
+    return os << '"';
+  }
+}
+
+Profiler& Profiler::get() {
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::Profiler() : enabled(false), origin(std::chrono::steady_clock::now()) {}
+
+int64_t Profiler::now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+Profiler::Scope::Scope(const char *phase, int scc, const std::string& detail)
+    : phase(phase), scc(scc), start(-1) {
+  Profiler& profiler = Profiler::get();
+  if(profiler.isEnabled()) {
+    this->detail = detail;
+    start = profiler.now();
+  }
+}
+
+Profiler::Scope::~Scope() {
+  if(start >= 0) {
+    Profiler::get().record(phase, scc, detail, start);
+  }
+}
+
+void Profiler::record(const char *phase, int scc, const std::string& detail, int64_t start) {
+  int64_t end = now();
+  std::lock_guard<std::mutex> guard(lock);
+  auto ite = threads.find(std::this_thread::get_id());
+  if(ite == threads.end()) {
+    ite = threads.emplace(std::this_thread::get_id(), threads.size()).first;
+  }
+  events.push_back(Event{phase, scc, detail, start, end - start, ite->second});
+}
+
+void Profiler::begin(const char *phase) {
+  if(!isEnabled()) {
+    return;
+  }
+  int64_t start = now();
+  std::lock_guard<std::mutex> guard(lock);
+  openPhases[phase] = start;
+}
+
+void Profiler::end(const char *phase) {
+  if(!isEnabled()) {
+    return;
+  }
+  int64_t start;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto ite = openPhases.find(phase);
+    if(ite == openPhases.end()) {
+      return;
+    }
+    start = ite->second;
+    openPhases.erase(ite);
+  }
+  record(phase, Module, "", start);
+}
+
+void Profiler::count(const std::string& name, int64_t n, int scc) {
+  if(!isEnabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  counters[scc][name] += n;
+}
+
+void Profiler::nameScc(int scc, const std::string& name) {
+  if(!isEnabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  sccNames[scc] = name;
+}
+
+// {
+//   "module": {"phases": {<phase>: {"count": n, "us": t}}, "counters": {...}},
+//   "sccs": [{"scc": i, "name": ..., "us": <total>, "phases": {...}, "counters": {...}}, ...]
+// }
+// SCCs are sorted by their total time, the most expensive first.
+void Profiler::writeJSON(raw_ostream& os) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  struct PhaseTotal {
+    int64_t count = 0;
+    int64_t us = 0;
+  };
+  std::map<int, std::map<std::string, PhaseTotal>> phases;
+  std::map<int, int64_t> sccTotal;
+  for(const auto& e : events) {
+    auto& total = phases[e.scc][e.phase];
+    total.count += 1;
+    total.us += e.duration;
+    if(e.scc != Module) {
+      sccTotal[e.scc] += e.duration;
+    }
+  }
+
+  auto writeScc = [&](int scc) {
+    os << "\"phases\": {";
+    bool first = true;
+    for(const auto& kv : phases[scc]) {
+      os << (first ? "" : ", ") << Quoted{kv.first} << ": {\"count\": " << kv.second.count
+         << ", \"us\": " << kv.second.us << "}";
+      first = false;
+    }
+    os << "}, \"counters\": {";
+    first = true;
+    for(const auto& kv : counters[scc]) {
+      os << (first ? "" : ", ") << Quoted{kv.first} << ": " << kv.second;
+      first = false;
+    }
+    os << "}";
+  };
+
+  std::vector<int> sccs;
+  for(const auto& kv : phases) {
+    if(kv.first != Module) {
+      sccs.push_back(kv.first);
+    }
+  }
+  for(const auto& kv : counters) {
+    if(kv.first != Module && phases.count(kv.first) == 0) {
+      sccs.push_back(kv.first);
+    }
+  }
+  std::stable_sort(sccs.begin(), sccs.end(), [&](int a, int b) {
+    return sccTotal[a] > sccTotal[b];
+  });
+
+  os << "{\n  \"module\": {";
+  writeScc(Module);
+  os << "},\n  \"sccs\": [";
+  for(unsigned i = 0; i < sccs.size(); i++) {
+    int scc = sccs[i];
+    os << (i == 0 ? "\n    " : ",\n    ") << "{\"scc\": " << scc << ", \"name\": " << Quoted{sccNames[scc]}
+       << ", \"us\": " << sccTotal[scc] << ", ";
+    writeScc(scc);
+    os << "}";
+  }
+  os << "\n  ]\n}\n";
+}
+
+void Profiler::writeChromeTrace(raw_ostream& os) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  os << "{\"traceEvents\": [";
+  bool first = true;
+  for(const auto& e : events) {
+    std::string name = e.phase;
+    if(e.scc != Module) {
+      name += " #" + std::to_string(e.scc);
+    }
+    os << (first ? "\n  " : ",\n  ") << "{\"name\": " << Quoted{name} << ", \"cat\": \"flowuni\", \"ph\": \"X\""
+       << ", \"ts\": " << e.start << ", \"dur\": " << e.duration << ", \"pid\": 1, \"tid\": " << e.thread
+       << ", \"args\": {";
+    bool firstArg = true;
+    if(e.scc != Module) {
+      os << "\"scc\": " << e.scc;
+      auto ite = sccNames.find(e.scc);
+      if(ite != sccNames.end()) {
+        os << ", \"members\": " << Quoted{ite->second};
+      }
+      firstArg = false;
+    }
+    if(!e.detail.empty()) {
+      os << (firstArg ? "" : ", ") << "\"detail\": " << Quoted{e.detail};
+    }
+    os << "}}";
+    first = false;
+  }
+  os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+char ProfileMarker::ID = 0;
+
+ProfileMarker::ProfileMarker(const char *phase, bool begin) : ModulePass(ID), phase(phase), isBegin(begin) {}
+
+void ProfileMarker::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.setPreservesAll();
+}
+
+bool ProfileMarker::runOnModule(Module &M) {
+  if(isBegin) {
+    Profiler::get().begin(phase);
+  } else {
+    Profiler::get().end(phase);
+  }
+  return false;
+}
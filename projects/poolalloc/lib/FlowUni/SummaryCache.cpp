@@ -0,0 +1,250 @@
+//
+// On-disk cache of the bottom-up results of SCCs, so that unchanged SCCs are not re-analyzed.
+//
+
+#include "dsa/DSGraph.h"
+#include "flowuni/SummaryCache.h"
+#include "flowuni/SummaryText.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+namespace {
+  // Bump when the format or the analysis changes, to invalidate existing entries.
+  const char *CacheMagic = "flowuni-summary 2";
+
+  // Collect global variables used by the constant 'c', looking through constant expressions.
+  void collectGlobals(Constant *c, std::set<GlobalVariable*>& globals, std::unordered_set<Constant*>& visited) {
+    if(not visited.insert(c).second) {
+      return;
+    }
+    if(auto gv = dyn_cast<GlobalVariable>(c)) {
+      globals.insert(gv);
+      if(gv->hasInitializer()) {
+        collectGlobals(gv->getInitializer(), globals, visited);
+      }
+      return;
+    }
+    if(isa<GlobalValue>(c)) {
+      return;
+    }
+    for(auto& op : c->operands()) {
+      if(auto opc = dyn_cast<Constant>(op)) {
+        collectGlobals(opc, globals, visited);
+      }
+    }
+  }
+}
+
+SummaryCache::SummaryCache(std::string dir) : dir(dir) {
+
+}
+
+std::string SummaryCache::entryPath(const std::string& key) const {
+  return dir + "/" + key + ".summary";
+}
+
+std::string SummaryCache::computeKey(const std::unordered_set<Function*>& members,
+                                     const std::vector<std::string>& calleeKeys) {
+  std::vector<Function*> sorted(members.begin(), members.end());
+  std::sort(sorted.begin(), sorted.end(), [](Function *a, Function *b) {
+    return a->getName() < b->getName();
+  });
+
+  std::string text;
+  raw_string_ostream os(text);
+  os << CacheMagic << "\n";
+  // Summaries computed field-sensitively are more precise, so they are kept apart.
+  if(LocalFCP::isFieldSensitive()) {
+    os << "field-sensitive\n";
+  }
+
+  std::set<GlobalVariable*> globals;
+  std::unordered_set<Constant*> visited;
+  for(auto f : sorted) {
+    f->print(os);
+    for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+      for(auto& op : inst_ite->operands()) {
+        if(auto c = dyn_cast<Constant>(op)) {
+          collectGlobals(c, globals, visited);
+        }
+      }
+    }
+  }
+
+  std::vector<GlobalVariable*> sortedGlobals(globals.begin(), globals.end());
+  std::sort(sortedGlobals.begin(), sortedGlobals.end(), [](GlobalVariable *a, GlobalVariable *b) {
+    return a->getName() < b->getName();
+  });
+  for(auto gv : sortedGlobals) {
+    gv->print(os);
+    os << "\n";
+  }
+
+  std::vector<std::string> callees(calleeKeys);
+  std::sort(callees.begin(), callees.end());
+  for(const auto& k : callees) {
+    os << "callee " << k << "\n";
+  }
+  os.flush();
+
+  return hashSummaryText(text);
+}
+
+DSNode* SummaryCache::resolveMemObject(Function *f, DSGraph *dsg, const MemObjectPath& path) {
+  DSNodeHandle h;
+  if(path.root == MemObjectPath::Globals) {
+    return LocalMemSSA::GlobalsLeader;
+  } else if(path.root == MemObjectPath::Returned) {
+    auto retIte = dsg->getReturnNodes().find(f);
+    if(retIte == dsg->getReturnNodes().end()) {
+      return nullptr;
+    }
+    h = retIte->second;
+  } else {
+    if(path.argNo >= f->arg_size()) {
+      return nullptr;
+    }
+    auto arg_ite = f->arg_begin();
+    std::advance(arg_ite, path.argNo);
+    if(not dsg->hasNodeForValue(&*arg_ite)) {
+      return nullptr;
+    }
+    h = dsg->getNodeForValue(&*arg_ite);
+  }
+  DSNode *node = path.follow(h).getNode();
+  if(node == nullptr) {
+    return nullptr;
+  }
+  return node->isGlobalNode() ? LocalMemSSA::GlobalsLeader : node;
+}
+
+bool SummaryCache::store(const std::string& key, const std::unordered_set<Function*>& members,
+                         DataStructures *dsa, LocalMemSSAWrapper *memSSA, const LocalFCP& fcp) {
+  SummaryWriter writer;
+
+  for(auto f : members) {
+    // Graphs at returning points, by the ReturnInst in the value table.
+    for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+      if(isa<ReturnInst>(*inst_ite)) {
+        auto ite = fcp.dataIn.find(&*inst_ite);
+        if(ite != fcp.dataIn.end()) {
+          writer.addGraph("ret " + std::to_string(writer.get(&*inst_ite)), ite->second);
+        }
+      }
+    }
+
+    // Graphs at the last definitions of memory objects visible to callers.
+    std::unordered_map<DSNode*, std::string> paths;
+    MemObjectPath::forEach(f, dsa->getDSGraph(*f), [&](DSNode *n, const MemObjectPath& path) {
+      paths[n] = path.str();
+    });
+    for(const auto& kv : memSSA->ssa.at(f).retMemLastDef) {
+      std::string path;
+      if(kv.first == LocalMemSSA::GlobalsLeader) {
+        path = "G";
+      } else if(paths.count(kv.first) > 0) {
+        path = paths[kv.first];
+      } else {
+        // Not reachable from any callsite.
+        continue;
+      }
+      auto ite = fcp.dataIn.find(kv.second);
+      if(ite != fcp.dataIn.end()) {
+        writer.addGraph("lastdef " + path + " " + f->getName().str(), ite->second);
+      }
+    }
+  }
+
+  writer.addGraph("summary", fcp.summary);
+
+  if(writer.failed()) {
+    return false;
+  }
+
+  if(sys::fs::create_directories(dir)) {
+    errs() << "Can not create summary cache directory " << dir << "\n";
+    return false;
+  }
+  return writeSummaryFile(entryPath(key), std::string(CacheMagic) + "\n" + writer.str());
+}
+
+bool SummaryCache::load(const std::string& key, const std::unordered_set<Function*>& members,
+                        DataStructures *dsa, LocalMemSSAWrapper *memSSA, LocalFCP& fcp) {
+  std::unique_ptr<MemoryBuffer> buffer = readSummaryFile(entryPath(key));
+  if(buffer == nullptr) {
+    return false;
+  }
+  StringRef magic, text;
+  std::tie(magic, text) = buffer->getBuffer().split('\n');
+  if(magic != CacheMagic) {
+    return false;
+  }
+
+  Module *M = (*members.begin())->getParent();
+  SummaryReader reader(text, M);
+
+  // Read the entry into a fresh LocalFCP, so that a corrupted entry leaves nothing behind.
+  LocalFCP loaded;
+  loaded.clear();
+
+  // Placeholders are renamed into fresh ones of 'loaded'. All other Values are named relative to
+  // this module, so they are all found unless the entry is corrupted.
+  if(!reader.readValues(loaded.placeholders)) {
+    return false;
+  }
+  for(Value *v : reader.values) {
+    if(v == nullptr) {
+      return false;
+    }
+  }
+
+  StringRef header;
+  while(reader.nextHeader(header)) {
+    PointToGraph *g;
+    if(header == "summary") {
+      g = &loaded.summary;
+    } else {
+      // "ret <value>" or "lastdef <path> <function>"
+      StringRef kind, rest;
+      std::tie(kind, rest) = header.split(' ');
+      Instruction *inst = nullptr;
+      if(kind == "ret") {
+        inst = dyn_cast_or_null<ReturnInst>(reader.getValue(rest));
+        if(inst != nullptr && members.count(inst->getParent()->getParent()) == 0) {
+          inst = nullptr;
+        }
+      } else if(kind == "lastdef") {
+        StringRef pathText, funcName;
+        std::tie(pathText, funcName) = rest.split(' ');
+        Function *f = M->getFunction(funcName);
+        MemObjectPath path;
+        DSNode *node = nullptr;
+        if(f != nullptr && members.count(f) > 0 && MemObjectPath::parse(pathText, path)) {
+          node = resolveMemObject(f, dsa->getDSGraph(*f), path);
+        }
+        if(node != nullptr) {
+          const auto& lastDef = memSSA->ssa.at(f).retMemLastDef;
+          auto ite = lastDef.find(node);
+          inst = ite == lastDef.end() ? nullptr : ite->second;
+        }
+      }
+      if(inst == nullptr) {
+        return false;
+      }
+      loaded.DUGNodes.insert(inst);
+      g = &loaded.dataIn.emplace(inst, PointToGraph(loaded.numbering.get())).first->second;
+    }
+    if(!reader.readGraph(*g)) {
+      return false;
+    }
+  }
+
+  fcp = std::move(loaded);
+  return true;
+}
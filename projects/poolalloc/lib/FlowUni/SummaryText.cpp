@@ -0,0 +1,438 @@
+//
+// The text form of point-to graphs shared by the summary cache and the module summaries.
+//
+
+#include "flowuni/SummaryText.h"
+#include "flowuni/MemSSA.h"
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <unordered_set>
+
+using namespace llvm;
+
+std::string MemObjectPath::str() const {
+  std::string s;
+  if(root == Globals) {
+    s = "G";
+  } else if(root == Returned) {
+    s = "r";
+  } else {
+    s = "a" + std::to_string(argNo);
+  }
+  for(int off : offsets) {
+    s += "." + std::to_string(off);
+  }
+  return s;
+}
+
+bool MemObjectPath::parse(StringRef s, MemObjectPath& path) {
+  SmallVector<StringRef, 8> parts;
+  s.split(parts, ".");
+  path.argNo = 0;
+  path.offsets.clear();
+  if(parts[0] == "r") {
+    path.root = Returned;
+  } else if(parts[0] == "G") {
+    path.root = Globals;
+  } else if(parts[0].size() > 1 && parts[0][0] == 'a'
+            && SummaryReader::parseUnsigned(parts[0].substr(1), path.argNo)) {
+    path.root = Argument;
+  } else {
+    return false;
+  }
+  for(unsigned i = 1; i < parts.size(); i++) {
+    int off;
+    if(parts[i].getAsInteger(10, off)) {
+      return false;
+    }
+    path.offsets.push_back(off);
+  }
+  return true;
+}
+
+DSNodeHandle MemObjectPath::follow(DSNodeHandle h) const {
+  for(int rel : offsets) {
+    DSNode *n = h.getNode();
+    if(n == nullptr || n->getSize() == 0) {
+      return DSNodeHandle();
+    }
+    int off = (rel + (int)h.getOffset()) % (int)n->getSize();
+    if(off < 0) {
+      off += n->getSize();
+    }
+    // The DSGraph of a caller only has the links the caller itself creates or sees.
+    if(not n->hasLink(off)) {
+      return DSNodeHandle();
+    }
+    h = n->getLink(off);
+  }
+  return h;
+}
+
+void MemObjectPath::forEach(Function *f, DSGraph *dsg,
+                            const std::function<void(DSNode*, const MemObjectPath&)>& visit) {
+  std::vector<std::pair<DSNodeHandle, MemObjectPath>> worklist;
+  unsigned argNo = 0;
+  for(auto& arg : f->args()) {
+    if(arg.getType()->isPointerTy() && dsg->hasNodeForValue(&arg)) {
+      MemObjectPath path;
+      path.argNo = argNo;
+      worklist.push_back(std::make_pair(dsg->getNodeForValue(&arg), path));
+    }
+    argNo++;
+  }
+  auto retIte = dsg->getReturnNodes().find(f);
+  if(retIte != dsg->getReturnNodes().end() && retIte->second.getNode() != nullptr) {
+    MemObjectPath path;
+    path.root = Returned;
+    worklist.push_back(std::make_pair(retIte->second, path));
+  }
+
+  std::unordered_set<DSNode*> seen;
+  for(unsigned k = 0; k < worklist.size(); k++) {
+    DSNodeHandle h = worklist[k].first;
+    MemObjectPath path = worklist[k].second;
+    DSNode *n = h.getNode();
+    if(not seen.insert(n).second) {
+      continue;
+    }
+    if(not n->isGlobalNode()) {
+      visit(n, path);
+    } else if(seen.insert(LocalMemSSA::GlobalsLeader).second) {
+      // All globals are one memory object to callers.
+      MemObjectPath globals;
+      globals.root = Globals;
+      visit(LocalMemSSA::GlobalsLeader, globals);
+    }
+    for(auto edge_ite = n->edge_begin(); edge_ite != n->edge_end(); edge_ite++) {
+      if(edge_ite->second.getNode()) {
+        MemObjectPath next = path;
+        next.offsets.push_back((int)edge_ite->first - (int)h.getOffset());
+        worklist.push_back(std::make_pair(edge_ite->second, next));
+      }
+    }
+  }
+}
+
+SummaryWriter::SummaryWriter(Function *scope) : scope(scope), fail(false) {
+
+}
+
+unsigned SummaryWriter::get(Value *v) {
+  auto ite = index.find(v);
+  if(ite != index.end()) {
+    return ite->second;
+  }
+
+  // Values callers of 'scope' can not name are placeholders to them.
+  std::string entry = "f";
+  if(v == PointToGraph::unspecificSpace) {
+    entry = "u";
+  } else if(PointToGraph::isFakeValue(v)) {
+    entry = "f";
+  } else if(auto gv = dyn_cast<GlobalValue>(v)) {
+    // Globals local to the module can not be named by other modules either.
+    if(scope == nullptr || (!gv->hasLocalLinkage() && gv->hasName())) {
+      entry = "g " + gv->getName().str();
+    }
+  } else if(auto arg = dyn_cast<Argument>(v)) {
+    if(scope == nullptr || arg->getParent() == scope) {
+      entry = "a " + std::to_string(arg->getArgNo()) + " " + arg->getParent()->getName().str();
+    }
+  } else if(auto inst = dyn_cast<Instruction>(v)) {
+    Function *f = inst->getParent() ? inst->getParent()->getParent() : nullptr;
+    if(scope == nullptr && f == nullptr) {
+      fail = true;
+    } else if(scope == nullptr) {
+      auto& pos = positions[f];
+      if(pos.empty()) {
+        unsigned n = 0;
+        for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+          pos[&*inst_ite] = n++;
+        }
+      }
+      entry = "i " + std::to_string(pos.at(inst)) + " " + f->getName().str();
+    }
+  } else if(scope == nullptr) {
+    fail = true;
+  }
+
+  unsigned id = table.size();
+  table.push_back(entry);
+  index[v] = id;
+  return id;
+}
+
+void SummaryWriter::writeGraph(const CompactPointToGraph& g, const std::unordered_set<Value*>& sets) {
+  std::string text;
+  raw_string_ostream os(text);
+  for(const auto& members : g.members) {
+    os << "c";
+    for(Value *v : members) {
+      os << " " << get(v);
+    }
+    os << "\n";
+  }
+  for(unsigned c = 0; c < g.pointTo.size(); c++) {
+    if(g.pointTo[c] >= 0) {
+      os << "p " << c << " " << g.pointTo[c] << "\n";
+    }
+  }
+  if(g.valPointTo != nullptr) {
+    os << "v " << get(g.valPointTo) << "\n";
+  }
+  for(auto v : sets) {
+    os << "s " << get(v) << "\n";
+  }
+  os << "end\n";
+  graphs += os.str();
+}
+
+void SummaryWriter::addGraph(const std::string& header, const CompactPointToGraph& g) {
+  graphs += header + "\n";
+  writeGraph(g, {});
+}
+
+void SummaryWriter::addGraph(const std::string& header, const PointToGraph& g) {
+  // The classes carrying information, i.e. those with several members or pointing to another,
+  // and the classes they point to.
+  std::map<ResourceId, std::vector<ResourceId>> classes;
+  for(ResourceId id = 0; id < g.size(); id++) {
+    classes[g.eqClass.findConst(id)].push_back(id);
+  }
+
+  CompactPointToGraph compact;
+  compact.valPointTo = g.valPointTo;
+  std::vector<ResourceId> leaders;
+  std::unordered_map<ResourceId, int> classOf;
+  auto reach = [&](ResourceId leader) -> int {
+    auto ite = classOf.find(leader);
+    if(ite != classOf.end()) {
+      return ite->second;
+    }
+    int c = leaders.size();
+    classOf[leader] = c;
+    leaders.push_back(leader);
+    std::vector<Value*> members = {g.valueOf(leader)};
+    for(ResourceId id : classes[leader]) {
+      if(id != leader) {
+        members.push_back(g.valueOf(id));
+      }
+    }
+    compact.members.push_back(members);
+    return c;
+  };
+  for(const auto& kv : classes) {
+    if(kv.second.size() > 1 || g.pointTo.get(kv.first) != NoResource) {
+      reach(kv.first);
+    }
+  }
+  for(unsigned c = 0; c < leaders.size(); c++) {
+    ResourceId to = g.pointTo.get(leaders[c]);
+    compact.pointTo.push_back(to == NoResource ? -1 : reach(g.eqClass.findConst(to)));
+  }
+
+  graphs += header + "\n";
+  writeGraph(compact, g.valPointToSets);
+}
+
+std::string SummaryWriter::str() const {
+  std::string text = "values " + std::to_string(table.size()) + "\n";
+  for(const auto& entry : table) {
+    text += entry + "\n";
+  }
+  return text + graphs;
+}
+
+SummaryReader::SummaryReader(StringRef text, Module *M) : text(text), M(M) {
+
+}
+
+bool SummaryReader::parseUnsigned(StringRef s, unsigned& n) {
+  return !s.getAsInteger(10, n);
+}
+
+bool SummaryReader::nextLine(StringRef& line) {
+  if(text.empty()) {
+    return false;
+  }
+  std::tie(line, text) = text.split('\n');
+  return true;
+}
+
+bool SummaryReader::readValues(PlaceholderArena& placeholders) {
+  StringRef line, kind, rest, num, name;
+  unsigned numValues;
+  if(!nextLine(line) || !line.startswith("values ") || !parseUnsigned(line.substr(7), numValues)) {
+    return false;
+  }
+
+  std::unordered_map<Function*, std::vector<Instruction*>> insts;
+  values.clear();
+  for(unsigned i = 0; i < numValues; i++) {
+    if(!nextLine(line)) {
+      return false;
+    }
+    std::tie(kind, rest) = line.split(' ');
+    Value *v = nullptr;
+    if(kind == "u") {
+      v = PointToGraph::unspecificSpace;
+    } else if(kind == "f") {
+      v = placeholders.fresh();
+    } else if(kind == "g") {
+      v = M->getNamedValue(rest);
+    } else if(kind == "a" || kind == "i") {
+      unsigned n;
+      std::tie(num, name) = rest.split(' ');
+      if(!parseUnsigned(num, n)) {
+        return false;
+      }
+      Function *f = M->getFunction(name);
+      if(f != nullptr && kind == "a" && n < f->arg_size()) {
+        auto arg_ite = f->arg_begin();
+        std::advance(arg_ite, n);
+        v = &*arg_ite;
+      } else if(f != nullptr && kind == "i") {
+        auto& fInsts = insts[f];
+        if(fInsts.empty()) {
+          for(auto inst_ite = inst_begin(f); inst_ite != inst_end(f); inst_ite++) {
+            fInsts.push_back(&*inst_ite);
+          }
+        }
+        v = n < fInsts.size() ? fInsts[n] : nullptr;
+      }
+    } else {
+      return false;
+    }
+    values.push_back(v);
+  }
+  return true;
+}
+
+Value* SummaryReader::getValue(StringRef index) const {
+  unsigned i;
+  if(!parseUnsigned(index, i) || i >= values.size()) {
+    return nullptr;
+  }
+  return values[i];
+}
+
+bool SummaryReader::nextHeader(StringRef& header) {
+  return nextLine(header);
+}
+
+bool SummaryReader::readGraph(CompactPointToGraph& g, std::vector<Value*>& sets) {
+  StringRef line;
+  while(nextLine(line)) {
+    if(line == "end") {
+      return true;
+    }
+    SmallVector<StringRef, 8> record;
+    line.split(record, " ");
+    StringRef op = record[0];
+    if(op == "c") {
+      std::vector<Value*> members;
+      for(unsigned i = 1; i < record.size(); i++) {
+        Value *v = getValue(record[i]);
+        if(v == nullptr) {
+          return false;
+        }
+        members.push_back(v);
+      }
+      if(members.empty()) {
+        return false;
+      }
+      g.members.push_back(members);
+      g.pointTo.push_back(-1);
+    } else if(op == "p") {
+      unsigned x, y;
+      if(record.size() != 3 || !parseUnsigned(record[1], x) || !parseUnsigned(record[2], y)
+         || x >= g.members.size() || y >= g.members.size()) {
+        return false;
+      }
+      g.pointTo[x] = y;
+    } else if(op == "v" || op == "s") {
+      Value *v = record.size() == 2 ? getValue(record[1]) : nullptr;
+      if(v == nullptr) {
+        return false;
+      }
+      if(op == "v") {
+        g.valPointTo = v;
+      } else {
+        sets.push_back(v);
+      }
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool SummaryReader::readGraph(CompactPointToGraph& g) {
+  std::vector<Value*> sets;
+  return readGraph(g, sets) && sets.empty();
+}
+
+bool SummaryReader::readGraph(PointToGraph& g) {
+  CompactPointToGraph compact;
+  std::vector<Value*> sets;
+  if(!readGraph(compact, sets)) {
+    return false;
+  }
+  for(const auto& members : compact.members) {
+    for(unsigned i = 1; i < members.size(); i++) {
+      g.eqClass.merge(g.numbering->getId(members[0]), g.numbering->getId(members[i]));
+    }
+  }
+  for(unsigned c = 0; c < compact.pointTo.size(); c++) {
+    if(compact.pointTo[c] >= 0) {
+      g.setPointTo(compact.members[c][0], compact.members[compact.pointTo[c]][0]);
+    }
+  }
+  g.valPointTo = compact.valPointTo;
+  g.valPointToSets.insert(sets.begin(), sets.end());
+  return true;
+}
+
+std::string llvm::hashSummaryText(StringRef text) {
+  MD5 hash;
+  hash.update(text);
+  MD5::MD5Result result;
+  hash.final(result);
+  SmallString<32> str;
+  MD5::stringifyResult(result, str);
+  return str.str();
+}
+
+bool llvm::writeSummaryFile(const std::string& path, StringRef text) {
+  std::string tmpPath = path + ".tmp";
+  {
+    std::error_code ec;
+    raw_fd_ostream of(tmpPath, ec, sys::fs::F_Text);
+    if(ec) {
+      errs() << "Can not write " << tmpPath << ": " << ec.message() << "\n";
+      return false;
+    }
+    of << text;
+    of.close();
+    if(of.has_error()) {
+      of.clear_error();
+      sys::fs::remove(tmpPath);
+      return false;
+    }
+  }
+  return !sys::fs::rename(tmpPath, path);
+}
+
+std::unique_ptr<MemoryBuffer> llvm::readSummaryFile(const std::string& path) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+  if(!buffer) {
+    return nullptr;
+  }
+  return std::move(*buffer);
+}
@@ -0,0 +1,95 @@
+//
+// A small scheduler for a DAG of tasks, used to analyze independent SCCs concurrently.
+//
+
+#include "flowuni/TaskGraph.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace llvm;
+
+TaskGraph::TaskId TaskGraph::addTask(std::function<void()> fn) {
+  tasks.push_back(Task(fn));
+  return tasks.size() - 1;
+}
+
+void TaskGraph::addDependency(TaskId task, TaskId dependency) {
+  assert(task < tasks.size() && dependency < tasks.size());
+  assert(task != dependency && "A task can not depend on itself");
+  tasks[dependency].dependents.push_back(task);
+  tasks[task].numDependencies += 1;
+}
+
+void TaskGraph::run(unsigned numThreads) {
+  std::vector<unsigned> waitingFor(tasks.size());
+  std::deque<TaskId> ready;
+  for(TaskId t = 0; t < tasks.size(); t++) {
+    waitingFor[t] = tasks[t].numDependencies;
+    if(waitingFor[t] == 0) {
+      ready.push_back(t);
+    }
+  }
+
+  if(numThreads <= 1) {
+    unsigned numFinished = 0;
+    while(!ready.empty()) {
+      TaskId t = ready.front();
+      ready.pop_front();
+      tasks[t].fn();
+      numFinished += 1;
+      for(TaskId d : tasks[t].dependents) {
+        if(--waitingFor[d] == 0) {
+          ready.push_back(d);
+        }
+      }
+    }
+    assert(numFinished == tasks.size() && "Dependencies between tasks form a cycle");
+    return;
+  }
+
+  std::mutex lock;
+  std::condition_variable changed;
+  unsigned numFinished = 0;
+  unsigned numRunning = 0;
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> guard(lock);
+    while(true) {
+      // Nothing ready and nothing running means all tasks are finished (or the rest are stuck in a cycle).
+      changed.wait(guard, [&]() { return !ready.empty() || numRunning == 0; });
+      if(ready.empty()) {
+        changed.notify_all();
+        return;
+      }
+      TaskId t = ready.front();
+      ready.pop_front();
+      numRunning += 1;
+
+      guard.unlock();
+      tasks[t].fn();
+      guard.lock();
+
+      numRunning -= 1;
+      numFinished += 1;
+      for(TaskId d : tasks[t].dependents) {
+        if(--waitingFor[d] == 0) {
+          ready.push_back(d);
+        }
+      }
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for(unsigned i = 0; i < numThreads; i++) {
+    pool.push_back(std::thread(worker));
+  }
+  for(auto& th : pool) {
+    th.join();
+  }
+  assert(numFinished == tasks.size() && "Dependencies between tasks form a cycle");
+}
@@ -27,17 +27,22 @@ namespace {
   const char* COLOR_END = "\033[0m";
 }
 
+bool LocalFCP::isTestingAnnotation(CallInst *call) {
+  if(call->getCalledFunction() == nullptr) {
+    // Skip indirect call.
+    return false;
+  }
+  std::string funcName = call->getCalledFunction()->getName();
+  return funcName == "__may_pointTo" || funcName == "__may_pointTo_exactly"
+         || funcName == "__print_pointTo";
+}
+
 void LocalFCP::checkAssertions() {
   for(auto ite = DUGNodes.begin(); ite != DUGNodes.end(); ite++) {
     Instruction *inst = *ite;
     if(auto call = dyn_cast<CallInst>(inst)) {
-      if(call->getCalledFunction() == nullptr) {
-        // Skip indirect call.
-        continue;
-      }
-      std::string funcName = call->getCalledFunction()->getName();
-      if(funcName == "__may_pointTo" || funcName == "__may_pointTo_exactly"
-          || funcName == "__print_pointTo") {
+      if(isTestingAnnotation(call)) {
+        std::string funcName = call->getCalledFunction()->getName();
 
         std::unordered_set<Value*> ptrSet, checkedSet;
 
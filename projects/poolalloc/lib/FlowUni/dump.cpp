@@ -5,28 +5,161 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Regex.h"
 #include "dsa/DSGraph.h"
 
 #include "flowuni/MemSSA.h"
 #include "flowuni/LocalFCP.h"
+#include "flowuni/Dump.h"
 
 #include <set>
 #include <map>
 #include <queue>
-#include <fstream>
+#include <mutex>
 #include <sstream>
 
 using namespace llvm;
 namespace {
-  template<typename ... Args>
-  std::string string_format( const std::string& format, Args ... args )
-  {
-    size_t size = snprintf( nullptr, 0, format.c_str(), args ... ) + 1; // Extra space for '\0'
-    std::unique_ptr<char[]> buf( new char[ size ] );
-    snprintf( buf.get(), size, format.c_str(), args ... );
-    return std::string( buf.get(), buf.get() + size - 1 ); // We don't want the '\0' inside
+  static cl::opt<bool> DumpEnabled("flowuni-dump",
+    cl::desc("Dump DOT graphs of memory SSA and point-to graphs, and the DSA result"),
+    cl::init(false));
+
+  static cl::opt<std::string> DumpFilter("flowuni-dump-filter",
+    cl::desc("Only dump functions (and SCCs with a member) whose names match this regex"),
+    cl::value_desc("regex"), cl::init(""));
+
+  static cl::opt<std::string> DumpDir("flowuni-dump-dir",
+    cl::desc("Directory to write dumps into"),
+    cl::value_desc("directory"), cl::init("."));
+
+  static cl::opt<std::string> DumpArchive("flowuni-dump-archive",
+    cl::desc("Write all dumps into this gzip-compressed tar archive instead of separate files"),
+    cl::value_desc("file"), cl::init(""));
+
+  // A tar archive written as a sequence of gzip members, one per entry: gzip concatenates the
+  // decompressed members, so entries are compressed and written as soon as they are complete.
+  struct DumpArchiveWriter {
+    std::mutex lock;
+    std::unique_ptr<raw_fd_ostream> os;
+    bool compressed;
+
+    explicit DumpArchiveWriter(const std::string& fileName) : compressed(zlib::isAvailable()) {
+      std::error_code ec;
+      os.reset(new raw_fd_ostream(fileName, ec, sys::fs::F_None));
+      if(ec) {
+        errs() << "Can not write the dump archive " << fileName << ": " << ec.message() << "\n";
+        os.reset();
+      } else if(not compressed) {
+        errs() << "zlib is unavailable, the dump archive " << fileName << " is not compressed\n";
+      }
+    }
+
+    ~DumpArchiveWriter() {
+      if(os != nullptr) {
+        // The end of a tar archive: two zero blocks.
+        writeMember(std::string(1024, '\0'));
+      }
+    }
+
+    void add(const std::string& name, const std::string& content) {
+      std::lock_guard<std::mutex> guard(lock);
+      if(os == nullptr) {
+        return;
+      }
+      std::string entry;
+      if(name.size() >= 100) {
+        // Names that do not fit the header are given by a pax extended header.
+        // A record is "<length> path=<name>\n", where the length counts its own digits.
+        std::string record = " path=" + name + "\n";
+        size_t length = record.size() + 1;
+        while(std::to_string(length).size() + record.size() != length) {
+          length++;
+        }
+        appendEntry(entry, "PaxHeader", 'x', std::to_string(length) + record);
+      }
+      appendEntry(entry, name.substr(0, 99), '0', content);
+      writeMember(entry);
+    }
+
+  private:
+    static void appendEntry(std::string& out, const std::string& name, char type, const std::string& content) {
+      char header[512] = {};
+      memcpy(header, name.data(), name.size());
+      snprintf(header + 100, 8, "%07o", 0644);
+      snprintf(header + 108, 8, "%07o", 0);
+      snprintf(header + 116, 8, "%07o", 0);
+      snprintf(header + 124, 12, "%011llo", (unsigned long long)content.size());
+      snprintf(header + 136, 12, "%011o", 0);
+      header[156] = type;
+      memcpy(header + 257, "ustar", 6);
+      memcpy(header + 263, "00", 2);
+      memset(header + 148, ' ', 8);
+      unsigned checksum = 0;
+      for(unsigned char c : header) {
+        checksum += c;
+      }
+      snprintf(header + 148, 8, "%06o", checksum);
+
+      out.append(header, sizeof(header));
+      out.append(content);
+      out.append((512 - content.size() % 512) % 512, '\0');
+    }
+
+    void writeMember(const std::string& data) {
+      SmallVector<char, 0> deflated;
+      if(not compressed || zlib::compress(data, deflated, zlib::BestSpeedCompression) != zlib::StatusOK) {
+        os->write(data.data(), data.size());
+        return;
+      }
+      // A zlib stream is the raw deflate data between a 2-byte header and an Adler-32 checksum;
+      // gzip wraps the same data with its own header and a CRC-32.
+      static const char gzipHeader[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'};
+      os->write(gzipHeader, sizeof(gzipHeader));
+      os->write(deflated.data() + 2, deflated.size() - 6);
+      writeLE32(zlib::crc32(data));
+      writeLE32(data.size());
+    }
+
+    void writeLE32(uint32_t x) {
+      for(int i = 0; i < 4; i++) {
+        *os << (char)((x >> (8 * i)) & 0xff);
+      }
+    }
+  };
+
+  DumpArchiveWriter& dumpArchive() {
+    static DumpArchiveWriter archive(DumpArchive);
+    return archive;
   }
 
+  // Buffers one dump and adds it to the archive when destroyed.
+  class DumpArchiveEntry : public raw_ostream {
+    std::string name;
+    std::string content;
+
+    void write_impl(const char *ptr, size_t size) override {
+      content.append(ptr, size);
+    }
+
+    uint64_t current_pos() const override {
+      return content.size();
+    }
+
+  public:
+    explicit DumpArchiveEntry(const std::string& name) : name(name) {}
+
+    ~DumpArchiveEntry() override {
+      flush();
+      dumpArchive().add(name, content);
+    }
+  };
+
+  std::mutex dumpFilterLock;
+
   void replaceAll(std::string& str, const std::string& from, const std::string& to) {
     if(from.empty())
       return;
@@ -80,10 +213,18 @@ namespace {
     return str;
   }
 
-  std::string nodeName(const void* a, std::string prefix = "ptr") {
-    std::ostringstream os;
-    os << prefix << a;
-    return os.str();
+  // The name of the DOT node for 'a', written without building a string.
+  struct NodeName {
+    const void *a;
+    const char *prefix;
+  };
+
+  NodeName nodeName(const void* a, const char *prefix = "ptr") {
+    return NodeName{a, prefix};
+  }
+
+  raw_ostream& operator<<(raw_ostream& os, const NodeName& n) {
+    return os << n.prefix << n.a;
   }
 
   struct IndentLevel{
@@ -102,7 +243,7 @@ namespace {
 
   };
 
-  std::ostream& operator<<(std::ostream& os, const IndentLevel & ind) {
+  raw_ostream& operator<<(raw_ostream& os, const IndentLevel & ind) {
     for(int i = 0; i < ind.level; i++) {
       os << ind.chars;
     }
@@ -110,10 +251,62 @@ namespace {
   }
 };
 
+bool Dump::enabled() {
+  return DumpEnabled;
+}
+
+bool Dump::enabledFor(const Function *f) {
+  if(not DumpEnabled) {
+    return false;
+  }
+  if(DumpFilter.empty()) {
+    return true;
+  }
+  std::lock_guard<std::mutex> guard(dumpFilterLock);
+  static Regex filter(DumpFilter);
+  std::string error;
+  if(not filter.isValid(error)) {
+    static bool reported = false;
+    if(not reported) {
+      errs() << "Invalid -flowuni-dump-filter: " << error << "\n";
+      reported = true;
+    }
+    return false;
+  }
+  return filter.match(f->getName());
+}
+
+std::unique_ptr<raw_ostream> Dump::open(const std::string& name) {
+  if(not DumpEnabled) {
+    return nullptr;
+  }
+  if(not DumpArchive.empty()) {
+    return std::unique_ptr<raw_ostream>(new DumpArchiveEntry(name));
+  }
+
+  static std::once_flag createDir;
+  std::call_once(createDir, []() { sys::fs::create_directories(DumpDir.getValue()); });
+  SmallString<128> path(DumpDir.getValue());
+  sys::path::append(path, name);
+  std::error_code ec;
+  std::unique_ptr<raw_ostream> os(new raw_fd_ostream(path, ec, sys::fs::F_Text));
+  if(ec) {
+    errs() << "Can not write the dump " << path << ": " << ec.message() << "\n";
+    return nullptr;
+  }
+  return os;
+}
+
 void LocalMemSSA::dump(){
+  if(not Dump::enabledFor(func)) {
+    return;
+  }
+  std::unique_ptr<raw_ostream> out = Dump::open("memSSA." + func->getName().str() + ".dot");
+  if(out == nullptr) {
+    return;
+  }
+  raw_ostream& of = *out;
   showPhiNodes();
-  std::ofstream of;
-  of.open("memSSA." + func->getName().str() + ".dot", std::fstream::out);
 
   IndentLevel indent;
   of << "digraph {\n";
@@ -123,27 +316,27 @@ void LocalMemSSA::dump(){
   // Output all instructions as nodes
   for(auto inst = inst_begin(func); inst != inst_end(func); inst++) {
     const Instruction* addr = &*inst;
-    of << indent << string_format("%s[label=\"%s\"];\n", nodeName(addr).c_str(), toString(*inst).c_str());
+    of << indent << nodeName(addr) << "[label=\"" << *inst << "\"];\n";
   }
 
   // Clustering instructions by BasicBlocks
   int subCount = 0;
 
-  of << indent << string_format("subgraph cluster_%d{\n", subCount);
+  of << indent << "subgraph cluster_" << subCount << "{\n";
   subCount++;
   indent.inc();
   of << indent << "label=\"Control Flow Graph\";\n";
   of << indent << "style=\"invis\";\n";
 
   for(const auto& bb : *func) {
-    of << indent << string_format("subgraph cluster_%d{\n", subCount);
+    of << indent << "subgraph cluster_" << subCount << "{\n";
     subCount++;
     indent.inc();
     of << indent << "label=\"\";\n";
     of << indent << "style=\"\";\n";
     of << indent;
     for(const auto& inst : bb) {
-      of << string_format("%s;", nodeName(&inst).c_str());
+      of << nodeName(&inst) << ";";
     }
     of << "\n";
     indent.dec();
@@ -161,7 +354,7 @@ void LocalMemSSA::dump(){
     auto i2 = bb.begin();
     i2++;
     for(; i2 != bb.end(); i1++, i2++) {
-      of << indent << string_format("%s -> %s[color=grey];\n", nodeName(&*i1).c_str(), nodeName(&*i2).c_str());
+      of << indent << nodeName(&*i1) << " -> " << nodeName(&*i2) << "[color=grey];\n";
 
     }
 
@@ -172,7 +365,7 @@ void LocalMemSSA::dump(){
       for(const auto& succBB : successors(&bb)) {
         if(succBB->begin() != succBB->end()) {
           auto first = succBB->begin();
-          of << indent << string_format("%s -> %s;\n", nodeName(&*last).c_str(), nodeName(&*first).c_str());
+          of << indent << nodeName(&*last) << " -> " << nodeName(&*first) << ";\n";
         }
       }
     }
@@ -182,24 +375,24 @@ void LocalMemSSA::dump(){
   for(const auto& i_users : memSSAUsers) {
     Instruction* def = i_users.first;
     for(const auto& use : i_users.second) {
-      of << indent << string_format("%s -> %s[color=blue];\n", nodeName(def).c_str(), nodeName(use).c_str());
+      of << indent << nodeName(def) << " -> " << nodeName(use) << "[color=blue];\n";
     }
   }
 
   // Output all DSNode* as nodes
   for(auto n : memObjects) {
-     of << indent << string_format("%s[label=\"%s\"];\n", nodeName(n).c_str(), escapeString(trim(n->getCaption())).c_str());
+     of << indent << nodeName(n) << "[label=\"" << escapeString(trim(n->getCaption())) << "\"];\n";
   }
 
   // All DSNodes form a subgraph
-  of << indent << string_format("subgraph cluster_%d{\n", subCount);
+  of << indent << "subgraph cluster_" << subCount << "{\n";
   subCount++;
 
   indent.inc();
   of<<indent<<"label=\"DSNodes\";\n";
   of<<indent;
   for(auto n : memObjects) {
-    of << string_format("%s;", nodeName(n).c_str());
+    of << nodeName(n) << ";";
   }
   of << "\n";
   indent.dec();
@@ -213,39 +406,34 @@ void LocalMemSSA::dump(){
       Value *ptr = load->getPointerOperand();
       if(aliasResource(ptr)) {
         DSNode *n = dsgraph->getNodeForValue(ptr).getNode();
-        of << indent << string_format("%s -> %s[style=dotted];\n",
-                                      nodeName(load).c_str(), nodeName(n).c_str());
+        of << indent << nodeName(load) << " -> " << nodeName(n) << "[style=dotted];\n";
       }
     } else if(auto store = dyn_cast<StoreInst>(addr)) {
       Value *ptr = store->getPointerOperand();
       if(aliasResource(ptr)) {
         DSNode *n = dsgraph->getNodeForValue(ptr).getNode();
-        of << indent << string_format("%s -> %s[style=dotted];\n",
-                                      nodeName(store).c_str(), nodeName(n).c_str());
+        of << indent << nodeName(store) << " -> " << nodeName(n) << "[style=dotted];\n";
       }
     }
 #if 0 // CallInsts are replaced by fake phi nodes.
     else if(auto call = dyn_cast<CallInst>(addr)) {
       if(memModifiedByCall.count(call) > 0) {
         for(DSNode* n : memModifiedByCall[call]) {
-          // of << indent << string_format("%s -> %s[style=dotted];\n",
-          //                               nodeName(call).c_str(), nodeName(n).c_str());
+          // of << indent << nodeName(call) << " -> " << nodeName(n) << "[style=dotted];\n";
         }
       }
     }
 #endif
      else if(auto alloca = dyn_cast<AllocaInst>(addr)) {
       DSNode *n = dsgraph->getNodeForValue(alloca).getNode();
-      of << indent << string_format("%s -> %s[style=dotted];\n",
-                                    nodeName(n).c_str(), nodeName(alloca).c_str());
+      of << indent << nodeName(n) << " -> " << nodeName(alloca) << "[style=dotted];\n";
     }
   }
 
   // Add edges between our fake phi nodes and corresponding DSNode.
   for(const auto& kv : phiNodes) {
     for(const auto& np: kv.second) {
-      of << indent << string_format("%s -> %s[style=dotted];\n",
-                                    nodeName(np.second).c_str(), nodeName(np.first).c_str());
+      of << indent << nodeName(np.second) << " -> " << nodeName(np.first) << "[style=dotted];\n";
     }
   }
 
@@ -253,12 +441,10 @@ void LocalMemSSA::dump(){
   for(auto& kv : argIncomingMergePoint) {
     if(kv.first == GlobalsLeader) {
       for(auto n : globals) {
-        of << indent << string_format("%s -> %s[style=dotted];\n",
-                                      nodeName(kv.second).c_str(), nodeName(n).c_str());
+        of << indent << nodeName(kv.second) << " -> " << nodeName(n) << "[style=dotted];\n";
       }
     } else {
-      of << indent << string_format("%s -> %s[style=dotted];\n",
-                                    nodeName(kv.second).c_str(), nodeName(kv.first).c_str());
+      of << indent << nodeName(kv.second) << " -> " << nodeName(kv.first) << "[style=dotted];\n";
     }
   }
 
@@ -267,28 +453,28 @@ void LocalMemSSA::dump(){
     for(auto& np : kv.second) {
       if(np.first == GlobalsLeader) {
         for(auto n : globals) {
-          of << indent << string_format("%s -> %s[style=dotted];\n",
-                                        nodeName(np.second).c_str(), nodeName(n).c_str());
+          of << indent << nodeName(np.second) << " -> " << nodeName(n) << "[style=dotted];\n";
         }
       } else {
-        of << indent << string_format("%s -> %s[style=dotted];\n",
-                                      nodeName(np.second).c_str(), nodeName(np.first).c_str());
+        of << indent << nodeName(np.second) << " -> " << nodeName(np.first) << "[style=dotted];\n";
       }
     }
   }
 
   of << "}\n";
   indent.dec();
-
-  of.close();
+  out.reset();
 
   hidePhiNodes();
 }
 
 
 void LocalFCP::dump(std::string fileName) {
-  std::ofstream of;
-  of.open(fileName + ".dot", std::fstream::out);
+  std::unique_ptr<raw_ostream> out = Dump::open(fileName + ".dot");
+  if(out == nullptr) {
+    return;
+  }
+  raw_ostream& of = *out;
 
   IndentLevel indent;
   of << "digraph {\n";
@@ -306,7 +492,7 @@ void LocalFCP::dump(std::string fileName) {
         label = label + "\\n(for " + escapeString(trim(fakePhiSource[inst]->getCaption())) + ")";
       }
     }
-    of << indent << string_format("%s[label=\"%s\"];\n", nodeName(inst).c_str(), label.c_str());
+    of << indent << nodeName(inst) << "[label=\"" << label << "\"];\n";
   }
 
   auto resources = this->resources;
@@ -314,20 +500,20 @@ void LocalFCP::dump(std::string fileName) {
 
   // Emit all resources nodes.
   for(auto val: resources) {
-    of << indent << string_format("%s[label=\"%s\", color=\"green\"];\n", nodeName(val, "r").c_str(), PointToGraph::escape(val).c_str());
+    of << indent << nodeName(val, "r") << "[label=\"" << PointToGraph::escape(val) << "\", color=\"green\"];\n";
   }
 
   int numClusters = 0;
 
 #if 0
   // All values are a subgraph.
-  of << indent << string_format("subgraph cluster_%d{\n", numClusters++);
+  of << indent << "subgraph cluster_" << numClusters++ << "{\n";
   indent.inc();
 
   of<<indent<<"label=\"Values\";\n";
   of<<indent;
   for(auto inst: DUGNodes) {
-    of << string_format("%s;", nodeName(inst).c_str());
+    of << nodeName(inst) << ";";
   }
   of << "\n";
 
@@ -341,12 +527,12 @@ void LocalFCP::dump(std::string fileName) {
     partition[nodeSSA[inst]].insert(inst);
   }
   for(auto kv : partition) {
-    of << indent << string_format("subgraph cluster_%d{\n", numClusters++);
+    of << indent << "subgraph cluster_" << numClusters++ << "{\n";
     indent.inc();
 
     of<<indent;
     for(auto inst: kv.second) {
-      of << string_format("%s;", nodeName(inst).c_str());
+      of << nodeName(inst) << ";";
     }
     of << "\n";
 
@@ -356,13 +542,13 @@ void LocalFCP::dump(std::string fileName) {
 
 #if 0
   // All resources are a subgraph.
-  of << indent << string_format("subgraph cluster_%d{\n", numClusters++);
+  of << indent << "subgraph cluster_" << numClusters++ << "{\n";
   indent.inc();
 
   of<<indent<<"label=\"Resources\";\n";
   of<<indent;
   for(auto val: resources) {
-    of << string_format("%s;", nodeName(val, "r").c_str());
+    of << nodeName(val, "r") << ";";
   }
   of << "\n";
 
@@ -376,8 +562,8 @@ void LocalFCP::dump(std::string fileName) {
     if (!inst->getType()->isVoidTy()) {
       for(auto val: resources) {
         Value *to = dataOut[inst].valPointTo;
-        if(dataOut[inst].eqClass.equivalent(to, val)) {
-          of << indent << string_format("%s -> %s[color=\"grey\"];\n", nodeName(inst).c_str(), nodeName(val, "r").c_str());
+        if(dataOut[inst].equivalent(to, val)) {
+          of << indent << nodeName(inst) << " -> " << nodeName(val, "r") << "[color=\"grey\"];\n";
         }
       }
     }
@@ -386,32 +572,40 @@ void LocalFCP::dump(std::string fileName) {
   // Edges between DUGNodes
   for(auto inst : DUGNodes) {
     for(auto user : defuseEdges[inst]) {
-      of << indent << string_format("%s -> %s[color=\"blue\"];\n", nodeName(inst).c_str(), nodeName(user).c_str());
+      of << indent << nodeName(inst) << " -> " << nodeName(user) << "[color=\"blue\"];\n";
     }
   }
 
   of << "}\n";
   indent.dec();
-
-  of.close();
 }
 
 void LocalFCP::dumpSummary(std::string fileName) {
+  if(not Dump::enabled()) {
+    return;
+  }
   std::unordered_map<Value*, std::unordered_set<Value*>> partition;
-  for(auto kv : summary.eqClass.leader) {
-    auto leader = summary.eqClass.find(kv.first);
-    partition[leader].insert(kv.first);
-    partition[leader].insert(leader);
+  for(ResourceId id = 0; id < summary.eqClass.size(); id++) {
+    if(!summary.eqClass.isRoot(id)) {
+      auto leader = summary.find(summary.valueOf(id));
+      partition[leader].insert(summary.valueOf(id));
+      partition[leader].insert(leader);
+    }
   }
-  for(auto kv : summary.pointTo) {
-    auto leader = summary.eqClass.find(kv.first);
-    partition[leader].insert(leader);
-    leader = summary.eqClass.find(kv.second);
-    partition[leader].insert(leader);
+  for(ResourceId id = 0; id < summary.pointTo.size(); id++) {
+    if(summary.pointTo.get(id) != NoResource) {
+      auto leader = summary.find(summary.valueOf(id));
+      partition[leader].insert(leader);
+      leader = summary.find(summary.valueOf(summary.pointTo.get(id)));
+      partition[leader].insert(leader);
+    }
   }
 
-  std::ofstream of;
-  of.open(fileName + ".dot", std::fstream::out);
+  std::unique_ptr<raw_ostream> out = Dump::open(fileName + ".dot");
+  if(out == nullptr) {
+    return;
+  }
+  raw_ostream& of = *out;
 
   IndentLevel indent;
   of << "digraph {\n";
@@ -422,24 +616,23 @@ void LocalFCP::dumpSummary(std::string fileName) {
     for(auto r : kv.second) {
       label = label + PointToGraph::escape(r) + "\\n";
     }
-    of << indent << string_format("%s[label=\"%s\"];\n", nodeName(kv.first).c_str(), label.c_str());
+    of << indent << nodeName(kv.first) << "[label=\"" << label << "\"];\n";
   }
 
   for(const auto& kv : partition) {
     auto to = summary.getPointTo(kv.first);
     if(to != nullptr) {
-      auto leader = summary.eqClass.find(to);
-      of << indent << string_format("%s -> %s;\n", nodeName(kv.first).c_str(), nodeName(leader).c_str());
+      auto leader = summary.find(to);
+      of << indent << nodeName(kv.first) << " -> " << nodeName(leader) << ";\n";
     }
   }
 
   if(summary.valPointTo != nullptr) {
-    of << indent << string_format("%s[label=\"%s\"];\n", "ret", "<return>");
-    of << indent << string_format("%s -> %s;\n", "ret", nodeName(summary.eqClass.find(summary.valPointTo)).c_str());
+    of << indent << "ret[label=\"<return>\"];\n";
+    of << indent << "ret -> " << nodeName(summary.find(summary.valPointTo)) << ";\n";
   }
 
 
   of << "}\n";
   indent.dec();
-  of.close();
 }
@@ -27,46 +27,29 @@ using std::vector;
 
 namespace leakplug{
 
-    // Some common util functions
-    // ===================================
-    //
-    void LeakAnalysis::intersect(InstSet& a, const InstSet& b) {
-        for(auto ite = a.begin(); ite != a.end(); ) {
-            if(find(b.begin(), b.end(), *ite) == b.end()) {
-                ite = a.erase(ite);
-            } else {
-                ++ite;
-            }
-        }
-    }
-
     // Implementation for AllocatedMalloc
     // ===================================
     //
     LeakAnalysis::AllocatedMalloc::AllocatedMalloc(SimplifiedCFG& c) 
-        : LeakAnalysis::DataFlowAnalysis<InstSet>(c) {
+        : LeakAnalysis::DataFlowAnalysis<MallocSet>(c) {
 
     }
 
     void LeakAnalysis::AllocatedMalloc::initialization() {
         // entryT is empty set
         // top is the universal set (all malloc() call sites)
-        for(const auto& m : cfg.mallocCallSites) {
-            top.insert(m.first);
-        }
-        DataFlowAnalysis<InstSet>::initialization();
+        entryT = MallocSet(cfg.mallocs.size());
+        top = MallocSet(cfg.mallocs.size(), true);
+        DataFlowAnalysis<MallocSet>::initialization();
     }
 
-    void LeakAnalysis::AllocatedMalloc::meet(InstSet& a, const InstSet& b) {
-        intersect(a, b);
+    void LeakAnalysis::AllocatedMalloc::meet(MallocSet& a, const MallocSet& b) {
+        a &= b;
     }
 
-    void LeakAnalysis::AllocatedMalloc::transform(const Instruction* node, InstSet& x) {
-        if(auto *inst = dyn_cast<CallInst>(node)) {
-            const Value *calledFunc = inst->getCalledValue();
-            if(calledFunc == cfg.analysis.mallocF) {
-                x.insert(node);
-            }
+    void LeakAnalysis::AllocatedMalloc::transform(const SimplifiedCFG::Node& node, MallocSet& x) {
+        if(node.mallocId >= 0) {
+            x.set(node.mallocId);
         }
     }
 
@@ -74,32 +57,27 @@ namespace leakplug{
     // ===================================
     //
     LeakAnalysis::NotFreedMalloc::NotFreedMalloc(SimplifiedCFG& c) 
-        : LeakAnalysis::DataFlowAnalysis<InstSet>(c) {
+        : LeakAnalysis::DataFlowAnalysis<MallocSet>(c) {
 
     }
 
     void LeakAnalysis::NotFreedMalloc::initialization() {
         // both entry and top are the universal set (all malloc() call sites)
-        for(const auto& m : cfg.mallocCallSites) {
-            entryT.insert(m.first);
-            top.insert(m.first);
-        }
-        DataFlowAnalysis<InstSet>::initialization();
+        entryT = MallocSet(cfg.mallocs.size(), true);
+        top = MallocSet(cfg.mallocs.size(), true);
+        DataFlowAnalysis<MallocSet>::initialization();
     }
 
-    void LeakAnalysis::NotFreedMalloc::meet(InstSet& a, const InstSet& b) {
-        intersect(a, b);
+    void LeakAnalysis::NotFreedMalloc::meet(MallocSet& a, const MallocSet& b) {
+        a &= b;
     }
 
-    void LeakAnalysis::NotFreedMalloc::transform(const Instruction* node, InstSet& x) {
-        if(auto *inst = dyn_cast<CallInst>(node)) {
+    void LeakAnalysis::NotFreedMalloc::transform(const SimplifiedCFG::Node& node, MallocSet& x) {
+        if(auto *inst = dyn_cast<CallInst>(node.inst)) {
             const Value *calledFunc = inst->getCalledValue();
             if(calledFunc == cfg.analysis.freeF) {
                 // remove all possible malloc() maybe freed by this free() call
-                const auto& resources = cfg.mayPointsTo[inst->getArgOperand(0)];
-                for(auto r : resources) {
-                    x.erase(r);
-                }
+                x.reset(node.pointees);
             }
         }
     }
@@ -108,50 +86,31 @@ namespace leakplug{
     // ===================================
     //
     LeakAnalysis::UnusedAfter::UnusedAfter(SimplifiedCFG& c) 
-        : LeakAnalysis::DataFlowAnalysis<InstSet>(c, true) {
+        : LeakAnalysis::DataFlowAnalysis<MallocSet>(c, true) {
         // notice that we perform backward analysis by passing 'true' to base class
     }
 
     void LeakAnalysis::UnusedAfter::initialization() {
         // both top and entryT are the universal set
-        for(const auto& m : cfg.mallocCallSites) {
-            entryT.insert(m.first);
-            top.insert(m.first);
-        }
-        DataFlowAnalysis<InstSet>::initialization();
+        entryT = MallocSet(cfg.mallocs.size(), true);
+        top = MallocSet(cfg.mallocs.size(), true);
+        DataFlowAnalysis<MallocSet>::initialization();
     }
 
-    void LeakAnalysis::UnusedAfter::meet(InstSet& a, const InstSet& b) {
-        intersect(a, b);
+    void LeakAnalysis::UnusedAfter::meet(MallocSet& a, const MallocSet& b) {
+        a &= b;
     }
 
-    void LeakAnalysis::UnusedAfter::transform(const Instruction* node, InstSet& x) {
+    void LeakAnalysis::UnusedAfter::transform(const SimplifiedCFG::Node& node, MallocSet& x) {
         // remove all possible malloc()s maybe be used/free()d
-        const Value *ptr = nullptr;
-        if(auto *inst = dyn_cast<StoreInst>(node)) {
-            ptr = inst->getPointerOperand();
-        } else if (auto *inst = dyn_cast<LoadInst>(node)){
-            ptr = inst->getPointerOperand();
-        } else if (auto *inst = dyn_cast<CallInst>(node)) {
-            const Value *calledFunc = inst->getCalledValue();
-            if(calledFunc == cfg.analysis.freeF) {
-                ptr = inst->getArgOperand(0);
-            }
-        }
-        if(ptr) {
-            const auto& resources = cfg.mayPointsTo[ptr];
-            for(auto r : resources) {
-                x.erase(r);
-            }
-        }
+        x.reset(node.pointees);
     }
 
-    raw_ostream& operator<<(raw_ostream& os, const LeakAnalysis::InstSet& iset) {
+    void LeakAnalysis::SimplifiedCFG::print(raw_ostream& os, const MallocSet& set) const {
         os << " [ ";
-        for(auto i : iset) {
-            os << *i << ", ";
+        for(int i = set.find_first(); i != -1; i = set.find_next(i)) {
+            os << *mallocs[i] << ", ";
         }
         os << " ] ";
-        return os;
     }
 }
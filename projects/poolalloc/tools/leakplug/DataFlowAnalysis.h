@@ -16,42 +16,89 @@ namespace leakplug{
 
     template<typename T>
     void LeakAnalysis::DataFlowAnalysis<T>::initialization() {
-        data.clear();
+        data.assign(cfg.nodes.size(), top);
+        inList.assign(cfg.nodes.size(), false);
         for(const auto& i: cfg.allSites) {
-            worklist.push(i.first);
-            inList[i.first] = true;
-            data[i.first] = top;
+            worklist.push(i.second->id);
+            inList[i.second->id] = true;
         }
-        // Instruction* for entry is nullptr
-        data[nullptr] = entryT;
+        // Entry (and exit) is node 0
+        data[0] = entryT;
     }
 
     template<typename T>
     void LeakAnalysis::DataFlowAnalysis<T>::runAnalysis() {
-        // Use non-static member pointer to reuse code for backward analysis
-        auto pred = &LeakAnalysis::SimplifiedCFG::Node::pred;
-        auto succ = &LeakAnalysis::SimplifiedCFG::Node::succ;
-        if(backwardAnalysis) {
-            std::swap(pred, succ);
-        }
         while(worklist.size() > 0) {
-            const Instruction* node = worklist.front();
+            unsigned node = worklist.front();
             worklist.pop();
             inList[node] = false;
 
-            T m(top);
-            for(const auto& pred: (*cfg.allSites[node]).*pred) {
-                meet(m, data[pred->inst]);
+            if(visit(node)) {
+                pushDependents(node, worklist, inList);
+            }
+        }
+    }
+
+    template<typename T>
+    bool LeakAnalysis::DataFlowAnalysis<T>::visit(unsigned node) {
+        // The predecessors of a backward analysis are the successors in the CFG
+        const auto& n = *cfg.nodes[node];
+        T m(top);
+        for(const auto& pred: backwardAnalysis ? n.succ : n.pred) {
+            meet(m, data[pred->id]);
+        }
+        transform(n, m);
+        if(m != data[node]) {
+            data[node] = m;
+            return true;
+        }
+        return false;
+    }
+
+    template<typename T>
+    void LeakAnalysis::DataFlowAnalysis<T>::pushDependents(unsigned node, std::queue<unsigned>& queue,
+                                                           vector<char>& queued) const {
+        const auto& n = *cfg.nodes[node];
+        for(const auto& succ : backwardAnalysis ? n.pred : n.succ) {
+            // if succ->inst is nullptr, it is the exit and we want to ignore it
+            if(succ->inst && !queued[succ->id]) {
+                queue.push(succ->id);
+                queued[succ->id] = true;
             }
-            transform(node, m);
-            if(m != data[node]) {
-                data[node] = m;
-                for(const auto& succ : (*cfg.allSites[node]).*succ) {
-                    // if succ->inst is nullptr, it is the exit and we want to ignore it
-                    if(succ->inst && !inList[succ->inst]) {
-                        worklist.push(succ->inst);
-                        inList[succ->inst] = true;
-                    }
+        }
+    }
+
+    // The analyses are independent, so the product of their lattices reaches the same fixpoint
+    // as each of them alone. A node is queued once for all analyses, and a visit recomputes its
+    // data in each of them. Forward analyses queue successors, backward ones predecessors.
+    template<typename T>
+    void LeakAnalysis::runFused(const vector<DataFlowAnalysis<T>*>& analyses) {
+        if(analyses.empty()) {
+            return;
+        }
+        const SimplifiedCFG& cfg = analyses[0]->cfg;
+        std::queue<unsigned> worklist;
+        vector<char> queued(cfg.nodes.size(), false);
+        for(auto a : analyses) {
+            while(a->worklist.size() > 0) {
+                unsigned node = a->worklist.front();
+                a->worklist.pop();
+                a->inList[node] = false;
+                if(!queued[node]) {
+                    worklist.push(node);
+                    queued[node] = true;
+                }
+            }
+        }
+
+        while(worklist.size() > 0) {
+            unsigned node = worklist.front();
+            worklist.pop();
+            queued[node] = false;
+
+            for(auto a : analyses) {
+                if(a->visit(node)) {
+                    a->pushDependents(node, worklist, queued);
                 }
             }
         }
@@ -61,17 +108,17 @@ namespace leakplug{
     // Note that we don't need to rerun the whole analysis if the new_x is not greater than
     // the original data (i.e. meet(new_x, old_x) == new_x).
     template<typename T>
-    void LeakAnalysis::DataFlowAnalysis<T>::updateData(const Instruction* node, const T& new_x) {
+    void LeakAnalysis::DataFlowAnalysis<T>::updateData(unsigned node, const T& new_x) {
         // FIXME In LeakPlug we never updateData to greater one. This check can be removed for efficiency.
         auto tmp(new_x);
         meet(tmp, data[node]);
         if(tmp == new_x) {
             data[node] = new_x;
-            const auto& seeds = backwardAnalysis ? cfg.allSites[node]->pred : cfg.allSites[node]->succ;
+            const auto& seeds = backwardAnalysis ? cfg.nodes[node]->pred : cfg.nodes[node]->succ;
             for(const auto& succ : seeds) {
                 if(succ->inst) {
-                    worklist.push(succ->inst);
-                    inList[succ->inst] = true;
+                    worklist.push(succ->id);
+                    inList[succ->id] = true;
                 }
             }
             runAnalysis();
@@ -102,10 +149,14 @@ namespace leakplug{
 
         os << "\tdata{\n";
 
-        os << (dfa.backwardAnalysis ? "\t\texit: " : "\t\tentry : ") << dfa.entryT << "\n";
+        os << (dfa.backwardAnalysis ? "\t\texit: " : "\t\tentry : ");
+        cfg.print(os, dfa.entryT);
+        os << "\n";
 
         for(const auto& i : cfg.allSites) {
-            os << "\t\t" << instNumber[i.first] << " (line " <<  getLineNumber(i.first) << ") : "<< dfa.data[i.first] << "\n";
+            os << "\t\t" << instNumber[i.first] << " (line " <<  getLineNumber(i.first) << ") : ";
+            cfg.print(os, dfa.data[i.second->id]);
+            os << "\n";
         }
         os << "\t}\n";
         os << "}\n";
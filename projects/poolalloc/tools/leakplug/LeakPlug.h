@@ -8,6 +8,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/ADT/BitVector.h"
 
 #include "dsa/DSSupport.h"
 #include "dsa/DataStructure.h"
@@ -19,6 +20,8 @@
 #include <queue>
 #include <set>
 #include <map>
+#include <unordered_set>
+#include <unordered_map>
 
 namespace leakplug{
     using namespace llvm;
@@ -34,6 +37,10 @@ namespace leakplug{
 
         LeakPlug *pass;
         Function *F;
+        // Diagnostics of the analysis. Functions are analyzed concurrently, so the pass prints
+        // them afterwards, in the order of the functions.
+        std::string logText;
+        raw_string_ostream log;
         Module *M;
         AliasAnalysis *AA;
 #ifdef USEDSA
@@ -47,6 +54,10 @@ namespace leakplug{
         Value *freeF;
 
         AliasAnalysis::AliasResult alias(Value* a, Value* b);
+
+        // A set of malloc() call sites, by their ids in the SimplifiedCFG
+        typedef BitVector MallocSet;
+
         // The simplified CFG only contains malloc/free/store instructions
         struct SimplifiedCFG {
             const LeakAnalysis& analysis;
@@ -54,10 +65,16 @@ namespace leakplug{
                 const Instruction *inst;
                 vector< shared_ptr<Node> > succ;
                 vector< shared_ptr<Node> > pred;
+                // Index in 'nodes' (0 for both entry and exit)
+                unsigned id;
+                // Id of the malloc() call site, or -1
+                int mallocId;
+                // The malloc() call sites the pointer a load/store/free() uses may point to
+                MallocSet pointees;
                 Node(const Instruction *i);
             };
-            std::set<Value*> pointers;
-            std::map< const Value*, vector<const CallInst*> > mayPointsTo;
+            std::unordered_set<Value*> pointers;
+            std::unordered_map< const Value*, vector<const CallInst*> > mayPointsTo;
             std::map< const CallInst*, shared_ptr<Node> > mallocCallSites;
             std::map< const CallInst*, shared_ptr<Node> > freeCallSites;
             std::map< const StoreInst*, shared_ptr<Node> > storeSites;
@@ -68,7 +85,13 @@ namespace leakplug{
             shared_ptr<Node> entry;
             shared_ptr<Node> exit;
 
+            // Nodes and malloc() call sites by their ids, numbered in the order of 'allSites'
+            // and 'mallocCallSites'
+            vector< shared_ptr<Node> > nodes;
+            vector< const CallInst* > mallocs;
+
             SimplifiedCFG(const LeakAnalysis& a);
+            void print(raw_ostream& os, const MallocSet& set) const;
         } cfg;
         typedef std::shared_ptr<SimplifiedCFG::Node> PtrNode;
 
@@ -79,45 +102,52 @@ namespace leakplug{
             SimplifiedCFG &cfg;
             T entryT;
             T top;
-            std::map< const Instruction*, T > data;
-            std::queue< const Instruction* > worklist;
-            std::map< const Instruction*, bool > inList;
+            // Indexed by the ids of the nodes
+            vector<T> data;
+            std::queue<unsigned> worklist;
+            vector<char> inList;
 
-            virtual void transform(const Instruction* node, T& x) = 0;
+            virtual void transform(const SimplifiedCFG::Node& node, T& x) = 0;
             virtual void meet(T& a, const T& b) = 0;
             virtual void initialization();
 
             void runAnalysis();
-            void updateData(const Instruction* node, const T& new_x);
+            void updateData(unsigned node, const T& new_x);
+            // Recompute the data of 'node' from its neighbours. Returns whether it changed.
+            bool visit(unsigned node);
+            // Queue the nodes depending on 'node' into 'queue', unless 'queued' already.
+            void pushDependents(unsigned node, std::queue<unsigned>& queue, vector<char>& queued) const;
 
             DataFlowAnalysis(SimplifiedCFG& c, bool backward = false);
         };
 
-        typedef std::set<const Instruction*> InstSet;
-        static void intersect(InstSet& a, const InstSet& b);
+        // Run 'analyses' (initialized, forward or backward) over the same CFG to their fixpoints
+        // together, visiting each node once for all of them.
+        template<typename T>
+        static void runFused(const vector<DataFlowAnalysis<T>*>& analyses);
 
         // allocated malloc analysis
-        struct AllocatedMalloc : public DataFlowAnalysis<InstSet> {
+        struct AllocatedMalloc : public DataFlowAnalysis<MallocSet> {
             AllocatedMalloc(SimplifiedCFG& c);
             virtual void initialization() override;
-            virtual void transform(const Instruction* node, InstSet& x) override;
-            virtual void meet(InstSet& a, const InstSet& b) override;
+            virtual void transform(const SimplifiedCFG::Node& node, MallocSet& x) override;
+            virtual void meet(MallocSet& a, const MallocSet& b) override;
         };
         std::shared_ptr<AllocatedMalloc> allocatedMalloc;
 
-        struct NotFreedMalloc: public DataFlowAnalysis<InstSet> {
+        struct NotFreedMalloc: public DataFlowAnalysis<MallocSet> {
             NotFreedMalloc(SimplifiedCFG& c);
             virtual void initialization() override;
-            virtual void transform(const Instruction* node, InstSet& x) override;
-            virtual void meet(InstSet& a, const InstSet& b) override;
+            virtual void transform(const SimplifiedCFG::Node& node, MallocSet& x) override;
+            virtual void meet(MallocSet& a, const MallocSet& b) override;
         };
         std::shared_ptr<NotFreedMalloc> notFreedMalloc;
 
-        struct UnusedAfter: public DataFlowAnalysis<InstSet> {
+        struct UnusedAfter: public DataFlowAnalysis<MallocSet> {
             UnusedAfter(SimplifiedCFG& c);
             virtual void initialization() override;
-            virtual void transform(const Instruction* node, InstSet& x) override;
-            virtual void meet(InstSet& a, const InstSet& b) override;
+            virtual void transform(const SimplifiedCFG::Node& node, MallocSet& x) override;
+            virtual void meet(MallocSet& a, const MallocSet& b) override;
         };
         std::shared_ptr<UnusedAfter> unusedAfter;
 
@@ -132,14 +162,31 @@ namespace leakplug{
     raw_ostream& operator<<(raw_ostream& os, const LeakAnalysis::SimplifiedCFG& cfa);
     template<typename T>
     raw_ostream& operator<<(raw_ostream& os, LeakAnalysis::DataFlowAnalysis<T>& dfa);
-    raw_ostream& operator<<(raw_ostream& os, const LeakAnalysis::InstSet& iset);
 
     // LeakPlug class is the interface to the LLVM infrastructure
-    struct LeakPlug: public FunctionPass {
+    // The functions of the module are analyzed on 'numThreads' threads. Leaks are then fixed one
+    // function at a time.
+    struct LeakPlug: public ModulePass {
         static char ID;
-        LeakPlug();
+        explicit LeakPlug(unsigned numThreads = 1);
         void getAnalysisUsage(AnalysisUsage &AU) const override;
-        bool runOnFunction(Function &F) override;
+        bool runOnModule(Module &M) override;
+
+        // Analyses and functions shared by the LeakAnalysis of all functions
+        AliasAnalysis *AA;
+#ifdef USEDSA
+        EQTDDataStructures *DSA;
+        EquivBUDataStructures *BU_DSA;
+        StdLibDataStructures *stdlibDSA;
+        LocalDataStructures *localDSA;
+        MemoryEffectAnalysis *mea;
+#endif
+        Value *mallocF;
+        Value *freeF;
+        unsigned numThreads;
+
+        // Insert free()s for the leaks found by 'la', and record the patches to the source code
+        bool fixLeaks(LeakAnalysis& la);
 
         void freeOnEdge(const LeakAnalysis& la, LeakAnalysis::PtrNode head, LeakAnalysis::PtrNode tail, Instruction* resourceInst);
         void patchSourceCode(const LeakAnalysis& la, Value* resource, const Instruction* insertBefore);
@@ -9,12 +9,15 @@
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "LeakPlug.h"
 #include "DataFlowAnalysis.h"
+#include "flowuni/TaskGraph.h"
 
 #include "dsa/DSSupport.h"
 #include "dsa/DataStructure.h"
+#include "dsa/DSGraph.h"
 #include "dsa/DSCallGraph.h"
 
 #include <fstream>
@@ -23,47 +26,37 @@
 #include <queue>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <memory>
 #include <cstdio>
 
 using namespace llvm;
 using std::vector;
 
+static cl::opt<bool>
+PrintResults("leakplug-print", cl::desc("Print the simplified CFG and the data-flow results of each function"),
+             cl::init(false));
+
 namespace leakplug{
 
     // ======================= Definition for LeakAnalysis =============================
     //
     // =================================================================================
 
-    LeakAnalysis::LeakAnalysis(LeakPlug *pass, Function &Fref) : pass(pass), F(&Fref), cfg(*this) {
-        errs() << "Analysis on: " << F->getName() << '\n';
+    LeakAnalysis::LeakAnalysis(LeakPlug *pass, Function &Fref) : pass(pass), F(&Fref), log(logText), cfg(*this) {
+        log << "Analysis on: " << F->getName() << '\n';
         M = F->getParent();
-        AA = &pass->getAnalysis<AliasAnalysis>();
+        // The analyses, malloc() and free() are shared by all functions and looked up by the pass
+        AA = pass->AA;
 #ifdef USEDSA
-        // DSA = &pass->getAnalysis<EQTDDataStructures>();
-        // DSA->print(errs(), M);
-        localDSA = &pass->getAnalysis<LocalDataStructures>();
-        localDSA->print(errs(), M);
-
-        BU_DSA = &pass->getAnalysis<EquivBUDataStructures>();
-        BU_DSA -> print(errs(), M);
-
-        stdlibDSA = &pass->getAnalysis<StdLibDataStructures>();
-        stdlibDSA->print(errs(), M);
-
-        mea = &pass->getAnalysis<MemoryEffectAnalysis>();
-        mea->print(errs(), M);
+        DSA = pass->DSA;
+        BU_DSA = pass->BU_DSA;
+        stdlibDSA = pass->stdlibDSA;
+        localDSA = pass->localDSA;
+        mea = pass->mea;
 #endif
-
-        // get the malloc() function in the module
-        Type *BPTy = Type::getInt8PtrTy(F->getContext());
-        Type *Int64Ty = Type::getInt64Ty(F->getContext());
-        mallocF = M->getOrInsertFunction("malloc", BPTy, Int64Ty, nullptr);
-        errs() << "Address of malloc is " << mallocF << "\n"; 
-
-        // get the free() function in the same manner
-        Type *voidTy = Type::getVoidTy(F->getContext());
-        freeF = M->getOrInsertFunction("free", voidTy, BPTy, nullptr);
-        errs() << "Address of free is " << freeF << "\n";
+        mallocF = pass->mallocF;
+        freeF = pass->freeF;
     }
 
     AliasAnalysis::AliasResult LeakAnalysis::alias(Value* a, Value* b) {
@@ -85,7 +78,7 @@ namespace leakplug{
         }
     }
 
-    LeakAnalysis::SimplifiedCFG::Node::Node(const Instruction* i) : inst(i) {
+    LeakAnalysis::SimplifiedCFG::Node::Node(const Instruction* i) : inst(i), id(0), mallocId(-1) {
 
     }
 
@@ -98,21 +91,22 @@ namespace leakplug{
 
         allocatedMalloc = make_shared<AllocatedMalloc>(cfg);
         allocatedMalloc->initialization();
-        allocatedMalloc->runAnalysis();
-        errs() << "allocatedMalloc analysis result: \n";
-        errs() << *allocatedMalloc << "\n";
-
         notFreedMalloc = make_shared<NotFreedMalloc>(cfg);
         notFreedMalloc->initialization();
-        notFreedMalloc->runAnalysis();
-        errs() << "notFreedMalloc analysis result: \n";
-        errs() << *notFreedMalloc << "\n";
-
         unusedAfter = make_shared<UnusedAfter>(cfg);
         unusedAfter->initialization();
-        unusedAfter->runAnalysis();
-        errs() << "unusedAfter analysis result: \n";
-        errs() <<  *unusedAfter << "\n";
+
+        // The three analyses share one pass over the CFG
+        runFused<MallocSet>({allocatedMalloc.get(), notFreedMalloc.get(), unusedAfter.get()});
+
+        if(PrintResults) {
+            log << "allocatedMalloc analysis result: \n";
+            log << *allocatedMalloc << "\n";
+            log << "notFreedMalloc analysis result: \n";
+            log << *notFreedMalloc << "\n";
+            log << "unusedAfter analysis result: \n";
+            log <<  *unusedAfter << "\n";
+        }
     }
 
     int getLineNumber(const Instruction* I){
@@ -133,35 +127,56 @@ namespace leakplug{
             if(auto *inst = dyn_cast<CallInst>(&*I)) {
                 Value *calledFunc = inst->getCalledValue();
                 if(calledFunc == mallocF) {
-                    errs() << "Find malloc call at " << inst <<" : " << *inst <<"\n";
+                    log << "Find malloc call at " << inst <<" : " << *inst <<"\n";
                     cfg.allSites[inst] = cfg.mallocCallSites[inst] = make_shared<SimplifiedCFG::Node>(inst);
                 }
             }
         }
-        errs() << "Found " << cfg.mallocCallSites.size() << " malloc calls\n";
+        log << "Found " << cfg.mallocCallSites.size() << " malloc calls\n";
         if(cfg.mallocCallSites.size() == 0) {
             return;
         }
 
         // Find all pointers may point to results of malloc()s
 #ifdef USEDSA
-        // TODO modify it to use DSA
-        for(auto I = inst_begin(F); I != inst_end(F); I++) {
-            for(const auto& resource : cfg.mallocCallSites) {
-                AliasAnalysis::AliasResult res = AA->alias(resource.first, &*I);
-                if(res != AliasAnalysis::NoAlias) {
-                    errs() << *I << " " << aaResult(res) << " " << *resource.first << "\n";
-                    cfg.pointers.insert(&*I);
-                    cfg.mayPointsTo[&*I].push_back(resource.first);
+        // A pointer may point to the result of a malloc() if the DSNode it points to records the
+        // malloc() as one of its allocation sites. The malloc()s of each DSNode are looked up once.
+        DSGraph *G = BU_DSA->getDSGraph(*F);
+        std::unordered_map< const DSNode*, vector<const CallInst*> > mallocsOfNode;
+        auto getMallocs = [&](const DSNode *node) -> const vector<const CallInst*>& {
+            auto ite = mallocsOfNode.find(node);
+            if(ite != mallocsOfNode.end()) {
+                return ite->second;
+            }
+            vector<const CallInst*>& mallocs = mallocsOfNode[node];
+            for(const CallSite& site : node->getMallocSite()) {
+                auto *call = dyn_cast<CallInst>(site.getInstruction());
+                if(call && cfg.mallocCallSites.count(call) > 0) {
+                    mallocs.push_back(call);
                 }
             }
+            return mallocs;
+        };
+        for(auto I = inst_begin(F); I != inst_end(F); I++) {
+            if(!G->hasNodeForValue(&*I)) {
+                continue;
+            }
+            const DSNode *node = G->getNodeForValue(&*I).getNode();
+            if(!node) {
+                continue;
+            }
+            for(const CallInst *resource : getMallocs(node)) {
+                log << *I << " may point to " << *resource << "\n";
+                cfg.pointers.insert(&*I);
+                cfg.mayPointsTo[&*I].push_back(resource);
+            }
         }
 #else
         for(auto I = inst_begin(F); I != inst_end(F); I++) {
             for(const auto& resource : cfg.mallocCallSites) {
                 AliasAnalysis::AliasResult res = AA->alias(resource.first, &*I);
                 if(res != AliasAnalysis::NoAlias) {
-                    errs() << *I << " " << aaResult(res) << " " << *resource.first << "\n";
+                    log << *I << " " << aaResult(res) << " " << *resource.first << "\n";
                     cfg.pointers.insert(&*I);
                     cfg.mayPointsTo[&*I].push_back(resource.first);
                 }
@@ -169,7 +184,7 @@ namespace leakplug{
         }
 #endif
 
-        errs() << "Found " << cfg.pointers.size() << " pointers\n";
+        log << "Found " << cfg.pointers.size() << " pointers\n";
 
         // Find all relevant store/load/free() instruction
         for(auto I = inst_begin(F); I != inst_end(F); I++) {
@@ -177,21 +192,21 @@ namespace leakplug{
                 Value *calledFunc = inst->getCalledValue();
                 if(calledFunc == freeF) {
                     // We only consider pointers may point to results of malloc()s
-                    if(std::find(cfg.pointers.begin(), cfg.pointers.end(), inst->getArgOperand(0)) != cfg.pointers.end()){
-                        errs() << "Find free call at " << inst <<" : " << *inst <<"\n";
+                    if(cfg.pointers.count(inst->getArgOperand(0)) > 0) {
+                        log << "Find free call at " << inst <<" : " << *inst <<"\n";
                         cfg.allSites[inst] = cfg.freeCallSites[inst] = make_shared<SimplifiedCFG::Node>(inst);
                     }
                 }
             } else if(auto *inst = dyn_cast<StoreInst>(&*I)) {
                 Value *ptrOpr = inst->getPointerOperand();
-                if(std::find(cfg.pointers.begin(), cfg.pointers.end(), ptrOpr) != cfg.pointers.end()) {
-                    errs() << "Find store at " << inst << " : " << *inst << "\n";
+                if(cfg.pointers.count(ptrOpr) > 0) {
+                    log << "Find store at " << inst << " : " << *inst << "\n";
                     cfg.allSites[inst] = cfg.storeSites[inst] = make_shared<SimplifiedCFG::Node>(inst);
                 }
             } else if(auto *inst = dyn_cast<LoadInst>(&*I)) {
                 Value *ptrOpr = inst->getPointerOperand();
-                if(std::find(cfg.pointers.begin(), cfg.pointers.end(), ptrOpr) != cfg.pointers.end()) {
-                    errs() << "Find load at " << inst << " : " << *inst << "\n";
+                if(cfg.pointers.count(ptrOpr) > 0) {
+                    log << "Find load at " << inst << " : " << *inst << "\n";
                     cfg.allSites[inst] = cfg.loadSites[inst] = make_shared<SimplifiedCFG::Node>(inst);
                 }
             }
@@ -215,77 +230,65 @@ namespace leakplug{
             }
         }
 
-        errs() << "Found " << cfg.freeCallSites.size() << " free calls\n";
-        errs() << "Found " << cfg.storeSites.size() << " store sites\n";
-        errs() << "Found " << cfg.loadSites.size() << " load sites\n";
-        errs() << "Found " << cfg.retSites.size() << " ret sites\n";
+        log << "Found " << cfg.freeCallSites.size() << " free calls\n";
+        log << "Found " << cfg.storeSites.size() << " store sites\n";
+        log << "Found " << cfg.loadSites.size() << " load sites\n";
+        log << "Found " << cfg.retSites.size() << " ret sites\n";
 
         // now we can construct edges between CFG
-        int numInsts = 0;
-        std::map<const Instruction*, int> instNumber;
-        std::map<int, const Instruction*> numberInst;
-        for(auto I = inst_begin(F); I != inst_end(F); I++) {
-            instNumber[&*I] = numInsts;
-            numberInst[numInsts] = &*I;
-            numInsts++;
-        }
-        vector<int> connected(numInsts * numInsts);
-        auto index = [&](int i, int j){ 
-            return i * numInsts + j; 
-        };
-        for(int i = 0; i < numInsts; i++) {
-            connected[index(i, i)] = 1;
-        }
-
-        // Connect instruction with its successors
-        for(const auto& bb : *F) {
-            const Instruction *last = bb.getTerminator();
-            for(auto i = succ_begin(&bb); i != succ_end(&bb); i++) {
-                const Instruction* succ_inst = &*((*i)->begin());
-                connected[index(instNumber[last], instNumber[succ_inst])] = 1;
+        // Two sites are connected if a path between them only passes through unspecial
+        // instructions. Terminators are all sites, so such a path leaves a site, walks forward in
+        // the same basic block (or, from a terminator, in a successor block) and ends at the first
+        // site it meets. Each site is connected by one short walk per outgoing edge.
+        auto firstSiteFrom = [&](const Instruction *inst) {
+            BasicBlock::const_iterator I(inst);
+            while(cfg.allSites.find(&*I) == cfg.allSites.end()) {
+                I++;
             }
-            for(auto pi = bb.begin(); &*pi != last; pi++) {
-                auto next = pi;
-                next++;
-                connected[index(instNumber[&*pi], instNumber[&*next])] = 1;
-            }
-        }
-
-        // FIXME: simplify the graph building algorithm since we don't transit through basic blocks anymore
-
-        // Calculate the transitive closure under unspecial instructions
-        for(int k = 0; k < numInsts; k++) {
-            if(cfg.allSites.find(numberInst[k]) == cfg.allSites.end()) {
-                // transitive through unspecial instructions
-                for(int i = 0; i < numInsts; i++) {
-                    for(int j = 0; j < numInsts; j++) {
-                        connected[index(i, j)] |= connected[index(i, k)] && connected[index(k, j)];
-                    }
+            return &*I;
+        };
+        auto sitesAfter = [&](const Instruction *inst) {
+            std::set<const Instruction*> sites;
+            const BasicBlock *bb = inst->getParent();
+            if(inst == bb->getTerminator()) {
+                for(auto i = succ_begin(bb); i != succ_end(bb); i++) {
+                    sites.insert(firstSiteFrom(&*((*i)->begin())));
                 }
+            } else {
+                BasicBlock::const_iterator next(inst);
+                next++;
+                sites.insert(firstSiteFrom(&*next));
             }
-        }
+            return sites;
+        };
 
-        // Finally connects between special instructions
+        // Finally connects between special instructions (in the order of 'allSites', as both are
+        // ordered by address)
         for(const auto& i1 : cfg.allSites) {
-            for(const auto& i2: cfg.allSites) {
-                if(i1 == i2) {
+            for(const Instruction *succ : sitesAfter(i1.first)) {
+                if(succ == i1.first) {
                     continue;
                 }
-                if(connected[index(instNumber[i1.first], instNumber[i2.first])]) {
-                    i1.second->succ.push_back(i2.second);
-                    i2.second->pred.push_back(i1.second);
-                }
+                const auto& i2 = *cfg.allSites.find(succ);
+                i1.second->succ.push_back(i2.second);
+                i2.second->pred.push_back(i1.second);
             }
         }
 
         // Add entry and exit
         cfg.entry = make_shared<SimplifiedCFG::Node>(nullptr);
-        for(const auto& i : cfg.allSites) {
-            int entryInst = instNumber[&*(inst_begin(F))];
-            if(connected[index(entryInst, instNumber[i.first])]) {
-                cfg.entry->succ.push_back(i.second);
-                i.second->pred.push_back(cfg.entry);
-            }
+        const Instruction *entryInst = &*(inst_begin(F));
+        std::set<const Instruction*> entrySuccs;
+        if(cfg.allSites.find(entryInst) != cfg.allSites.end()) {
+            entrySuccs = sitesAfter(entryInst);
+            entrySuccs.insert(entryInst);
+        } else {
+            entrySuccs.insert(firstSiteFrom(entryInst));
+        }
+        for(const Instruction *succ : entrySuccs) {
+            const auto& i = *cfg.allSites.find(succ);
+            cfg.entry->succ.push_back(i.second);
+            i.second->pred.push_back(cfg.entry);
         }
 
         cfg.exit = make_shared<SimplifiedCFG::Node>(nullptr);
@@ -294,7 +297,38 @@ namespace leakplug{
             cfg.exit->pred.push_back(i.second);
         }
 
-        errs() << cfg << "\n";
+        // Number the nodes and malloc() call sites for the data-flow analyses
+        cfg.nodes.push_back(cfg.entry);
+        for(const auto& i : cfg.allSites) {
+            i.second->id = cfg.nodes.size();
+            cfg.nodes.push_back(i.second);
+        }
+        for(const auto& m : cfg.mallocCallSites) {
+            m.second->mallocId = cfg.mallocs.size();
+            cfg.mallocs.push_back(m.first);
+        }
+        for(const auto& i : cfg.allSites) {
+            const Value *ptr = nullptr;
+            if(auto *inst = dyn_cast<StoreInst>(i.first)) {
+                ptr = inst->getPointerOperand();
+            } else if(auto *inst = dyn_cast<LoadInst>(i.first)) {
+                ptr = inst->getPointerOperand();
+            } else if(auto *inst = dyn_cast<CallInst>(i.first)) {
+                if(inst->getCalledValue() == freeF) {
+                    ptr = inst->getArgOperand(0);
+                }
+            }
+            i.second->pointees = MallocSet(cfg.mallocs.size());
+            if(ptr) {
+                for(auto r : cfg.mayPointsTo[ptr]) {
+                    i.second->pointees.set(cfg.mallocCallSites[r]->mallocId);
+                }
+            }
+        }
+
+        if(PrintResults) {
+            log << cfg << "\n";
+        }
     }
 
     raw_ostream& operator<<(raw_ostream& os, const LeakAnalysis::SimplifiedCFG& cfg) {
@@ -337,7 +371,7 @@ namespace leakplug{
     //
     // =================================================================================
 
-    LeakPlug::LeakPlug() : FunctionPass(ID) {
+    LeakPlug::LeakPlug(unsigned numThreads) : ModulePass(ID), numThreads(numThreads) {
 
     }
 
@@ -353,15 +387,81 @@ namespace leakplug{
 #endif
     }
 
-    bool LeakPlug::runOnFunction(Function &F) {
-        LeakAnalysis la(this, F);
+    bool LeakPlug::runOnModule(Module &M) {
+        AA = &getAnalysis<AliasAnalysis>();
+#ifdef USEDSA
+        DSA = nullptr;
+        localDSA = &getAnalysis<LocalDataStructures>();
+        BU_DSA = &getAnalysis<EquivBUDataStructures>();
+        stdlibDSA = &getAnalysis<StdLibDataStructures>();
+        mea = &getAnalysis<MemoryEffectAnalysis>();
+        if(PrintResults) {
+            localDSA->print(errs(), &M);
+            BU_DSA->print(errs(), &M);
+            stdlibDSA->print(errs(), &M);
+            mea->print(errs(), &M);
+        }
+#endif
+
+        // get the malloc() function in the module
+        Type *BPTy = Type::getInt8PtrTy(M.getContext());
+        Type *Int64Ty = Type::getInt64Ty(M.getContext());
+        mallocF = M.getOrInsertFunction("malloc", BPTy, Int64Ty, nullptr);
+        errs() << "Address of malloc is " << mallocF << "\n";
+
+        // get the free() function in the same manner
+        Type *voidTy = Type::getVoidTy(M.getContext());
+        freeF = M.getOrInsertFunction("free", voidTy, BPTy, nullptr);
+        errs() << "Address of free is " << freeF << "\n";
+
+        std::vector<Function*> funcs;
+        for(auto& F : M) {
+            if(!F.isDeclaration()) {
+                funcs.push_back(&F);
+            }
+        }
+
+        // The functions are analyzed concurrently, and only read the IR and the analyses above
+        unsigned threads = numThreads;
+#ifdef USEDSA
+        // DSNodeHandles are redirected from forwarding nodes when they are read. Do it now, before
+        // the graphs are shared between threads.
+        for(Function *F : funcs) {
+            for(const auto& i : BU_DSA->getDSGraph(*F)->getScalarMap()) {
+                i.second.getNode();
+            }
+        }
+#else
+        // AliasAnalysis caches the results of queries
+        threads = 1;
+#endif
+        vector< std::unique_ptr<LeakAnalysis> > analyses(funcs.size());
+        TaskGraph tasks;
+        for(unsigned i = 0; i < funcs.size(); i++) {
+            tasks.addTask([this, &analyses, &funcs, i]() {
+                analyses[i].reset(new LeakAnalysis(this, *funcs[i]));
+                analyses[i]->runAnalysis();
+            });
+        }
+        tasks.run(threads);
+
+        for(const auto& la : analyses) {
+            errs() << la->log.str();
+        }
         // testing DSA
-        return 0;
+        return false;
 
-        la.runAnalysis();
-        if(la.cfg.mallocCallSites.size() == 0) {
-            return 0;
+        // Leaks are fixed, and the patches recorded, in the order of the functions in the module
+        bool modified = false;
+        for(const auto& la : analyses) {
+            if(la->cfg.mallocCallSites.size() > 0 && fixLeaks(*la)) {
+                modified = true;
+            }
         }
+        return modified;
+    }
+
+    bool LeakPlug::fixLeaks(LeakAnalysis& la) {
         // Leak fixing on IR
 
         // Strategy: Breath-first search from the entry to find edges satifying
@@ -388,24 +488,25 @@ namespace leakplug{
                     // it's the virtual exit node. Ignore.
                     continue;
                 }
-                LeakAnalysis::InstSet leak(la.allocatedMalloc->data[pnode->inst]);
-                LeakAnalysis::intersect(leak, la.notFreedMalloc->data[pnode->inst]);
-                LeakAnalysis::intersect(leak, la.unusedAfter->data[psucc->inst]);
-                if(leak.size() > 0) {
-                    for(const Instruction* r : leak) {
+                LeakAnalysis::MallocSet leak(la.allocatedMalloc->data[pnode->id]);
+                leak &= la.notFreedMalloc->data[pnode->id];
+                leak &= la.unusedAfter->data[psucc->id];
+                if(leak.any()) {
+                    for(int id = leak.find_first(); id != -1; id = leak.find_next(id)) {
+                        const Instruction* r = la.cfg.mallocs[id];
                         errs() << "Found a fixable leak " << *r << " (line " << getLineNumber(r) << ") , ";
                         errs() << "fix between " << *pnode->inst << " (line " << getLineNumber(pnode->inst) << ") and  ";
                         errs() << *psucc->inst << " (line " << getLineNumber(psucc->inst) << ")\n";
                         freeOnEdge(la, pnode, psucc, (Instruction*)r);
                         modified = 1;
                         // Update data flow analysis results
-                        LeakAnalysis::InstSet pnodeData = la.unusedAfter->data[pnode->inst];
-                        pnodeData.erase(r);
-                        la.unusedAfter->updateData(pnode->inst, pnodeData);
+                        LeakAnalysis::MallocSet pnodeData = la.unusedAfter->data[pnode->id];
+                        pnodeData.reset(id);
+                        la.unusedAfter->updateData(pnode->id, pnodeData);
 
-                        LeakAnalysis::InstSet psuccData = la.notFreedMalloc->data[psucc->inst];
-                        psuccData.erase(r);
-                        la.notFreedMalloc->updateData(psucc->inst, psuccData);
+                        LeakAnalysis::MallocSet psuccData = la.notFreedMalloc->data[psucc->id];
+                        psuccData.reset(id);
+                        la.notFreedMalloc->updateData(psucc->id, psuccData);
                     }
                 }
 
@@ -17,6 +17,10 @@
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/Path.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/InstIterator.h"
 
 
 #include "dsa/DSSupport.h"
@@ -25,55 +29,55 @@
 
 #include "LeakPlug.h"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <set>
 #include "flowuni/MemSSA.h"
 #include "flowuni/LocalFCP.h"
 #include "flowuni/BuFCP.h"
+#include "flowuni/Profile.h"
+#include "flowuni/ModuleSummary.h"
 
 using namespace llvm;
 
 // General options for sc.
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<input bytecode>..."), cl::ZeroOrMore);
+
 static cl::opt<std::string>
-InputFilename(cl::Positional, cl::desc("<input bytecode>"), cl::init("-"));
+InputList("input-list", cl::desc("File listing input bytecode files, one per line"), cl::value_desc("filename"),
+          cl::init(""));
 
 static cl::opt<std::string>
-OutputFilename("o", cl::desc("Output filename"), cl::value_desc("filename"));
+SummaryDir("summary-dir", cl::desc("Directory keeping the summaries of the functions each module exports "
+                                   "(read before, written after the analysis)"),
+           cl::value_desc("directory"), cl::init(""));
 
+static cl::opt<std::string>
+OutputFilename("o", cl::desc("Output filename"), cl::value_desc("filename"));
 
-int main(int argc, const char *argv[])
-{
-    MemoryEffectAnalysis a;
-    // FIXME: add -disable-dsa-stdlib option by default
-    cl::ParseCommandLineOptions(argc, argv, " llvm system compiler\n");
-    sys::PrintStackTraceOnErrorSignal();
+static cl::opt<bool>
+LazyMaterialize("lazy-materialize", cl::desc("Only materialize the functions connected to allocation sites by calls"),
+                cl::init(true));
 
-    // Load the module to be compiled...
-    std::string ErrorMessage;
-    std::unique_ptr<Module> M;
-    LLVMContext &Context = getGlobalContext();
+static cl::opt<unsigned>
+NumThreads("j", cl::desc("Number of threads for analyzing independent SCCs"), cl::value_desc("N"), cl::init(1));
 
-    // Use the bitcode streaming interface
-    DataStreamer *Streamer = getDataFileStreamer(InputFilename, &ErrorMessage);
-    if (Streamer) {
-        std::string DisplayFilename;
-        if (InputFilename == "-")
-            DisplayFilename = "<stdin>";
-        else
-            DisplayFilename = InputFilename;
-        ErrorOr<std::unique_ptr<Module>> MOrErr =
-            getStreamedBitcodeModule(DisplayFilename, Streamer, Context);
-        M = std::move(*MOrErr);
-        M->materializeAllPermanently();
-    }
+static cl::opt<std::string>
+ProfileOutput("flowuni-profile", cl::desc("Profile the analysis, writing <prefix>.json and <prefix>.trace.json"),
+              cl::value_desc("prefix"), cl::init(""));
 
-    if (M == nullptr) {
-        std::cerr << argv[0] << ": bytecode didn't read correctly.\n";
-        return 1;
-    }
 
+// Run the analysis on 'M'. Functions it declares are resolved against 'summaries', if given, and
+// the functions it exports are added to them.
+static void analyzeModule(Module &M, ModuleSummaries *summaries)
+{
     legacy::PassManager Passes;
 
+    Passes.add(new ProfileMarker("dsa", true));
 
     Passes.add(createBasicAliasAnalysisPass());
     Passes.add(new DominatorTreeWrapperPass());
@@ -87,20 +91,395 @@ int main(int argc, const char *argv[])
     Passes.add(new BUDataStructures());
     Passes.add(new CompleteBUDataStructures());
     Passes.add(new EquivBUDataStructures());
+    Passes.add(new ProfileMarker("dsa", false));
 //    Passes.add(new MemoryEffectAnalysis());
 //    Passes.add(new TDDataStructures());
 //    Passes.add(new EQTDDataStructures());
-    // Passes.add(new leakplug::LeakPlug());
+    // Passes.add(new leakplug::LeakPlug(NumThreads));
     Passes.add(new LocalMemSSAWrapper());
     // Passes.add(new LocalFCPWrapper());
-    Passes.add(new BuFCP());
+    Passes.add(new BuFCP(NumThreads, summaries));
 
 
     // Verify the final result
     Passes.add(createVerifierPass());
 
     // Run our queue of passes all at once now, efficiently.
-    Passes.run(*M.get());
+    Passes.run(M);
+}
+
+// Read 'filename' into 'Context', without materializing function bodies.
+static std::unique_ptr<Module> readModule(const std::string &filename, LLVMContext &Context)
+{
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr = MemoryBuffer::getFileOrSTDIN(filename);
+    if (!BufferOrErr)
+        return nullptr;
+    ErrorOr<Module*> MOrErr = getLazyBitcodeModule(std::move(*BufferOrErr), Context);
+    if (!MOrErr)
+        return nullptr;
+    return std::unique_ptr<Module>(*MOrErr);
+}
+
+// Functions whose callers may allocate or free memory. Callers of the annotations for testing are
+// kept as well.
+static const char *AllocFunctions[] = {
+    "malloc", "calloc", "realloc", "strdup", "free", "cfree",
+    "_Znwm", "_Znam", "_Znwj", "_Znaj", "_ZdlPv", "_ZdaPv",
+    "__may_pointTo", "__may_pointTo_exactly", "__print_pointTo"
+};
+
+// Materialize the functions of the lazily read 'M' that may be connected to allocation sites: the
+// functions calling (directly or not) an allocation function or a function 'isRelevant' says is
+// relevant (declarations that may allocate, or definitions other modules need), and all functions
+// these may call. The bodies of the others are deleted, i.e. they become declarations. The call
+// graph is collected one function at a time, so that not all bodies are in memory at once.
+// Returns false on errors.
+static bool materializeLazily(Module &M, const std::function<bool(Function*)> &isRelevant)
+{
+    std::set<std::string> allocFunctions(std::begin(AllocFunctions), std::end(AllocFunctions));
+
+    std::map<Function*, std::set<Function*>> callees, callers;
+    std::set<Function*> roots, addressTaken, indirectCallers;
+    for (Function &F : M) {
+        if (F.hasAddressTaken())   // e.g. by global initializers
+            addressTaken.insert(&F);
+        if (F.isDeclaration())
+            continue;
+        if (isRelevant(&F))
+            roots.insert(&F);
+        bool wasMaterializable = F.isMaterializable();
+        if (M.materialize(&F))
+            return false;
+        for (auto I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            CallSite CS(&*I);
+            Function *callee = nullptr;
+            if (CS) {
+                callee = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+                if (callee == nullptr) {
+                    indirectCallers.insert(&F);
+                } else if (!callee->isDeclaration()) {
+                    callees[&F].insert(callee);
+                    callers[callee].insert(&F);
+                } else if (allocFunctions.count(callee->getName()) > 0 || isRelevant(callee)) {
+                    roots.insert(&F);
+                }
+            }
+            for (Use &U : I->operands()) {
+                if (auto f = dyn_cast<Function>(U.get()->stripPointerCasts())) {
+                    if (!CS || !CS.isCallee(&U))
+                        addressTaken.insert(f);
+                }
+            }
+        }
+        if (wasMaterializable)
+            F.Dematerialize();
+    }
+
+    // Functions reaching the roots... Indirect calls may reach any function whose address is taken,
+    // including allocation functions called through pointers.
+    bool allocAddressTaken = false;
+    for (Function *f : addressTaken) {
+        if (f->isDeclaration() && (allocFunctions.count(f->getName()) > 0 || isRelevant(f)))
+            allocAddressTaken = true;
+    }
+    std::set<Function*> reaching(roots.begin(), roots.end());
+    std::vector<Function*> worklist(roots.begin(), roots.end());
+    bool addedIndirectCallers = false;
+    if (allocAddressTaken) {
+        addedIndirectCallers = true;
+        for (Function *caller : indirectCallers) {
+            if (reaching.insert(caller).second)
+                worklist.push_back(caller);
+        }
+    }
+    while (!worklist.empty()) {
+        Function *f = worklist.back();
+        worklist.pop_back();
+        for (Function *caller : callers[f]) {
+            if (reaching.insert(caller).second)
+                worklist.push_back(caller);
+        }
+        if (addressTaken.count(f) > 0 && !addedIndirectCallers) {
+            addedIndirectCallers = true;
+            for (Function *caller : indirectCallers) {
+                if (reaching.insert(caller).second)
+                    worklist.push_back(caller);
+            }
+        }
+    }
+
+    // ... and all functions they may call. Indirect calls may call any function whose address is taken.
+    std::set<Function*> needed(reaching.begin(), reaching.end());
+    worklist.assign(reaching.begin(), reaching.end());
+    bool addedAddressTaken = false;
+    while (!worklist.empty()) {
+        Function *f = worklist.back();
+        worklist.pop_back();
+        for (Function *callee : callees[f]) {
+            if (needed.insert(callee).second)
+                worklist.push_back(callee);
+        }
+        if (indirectCallers.count(f) > 0 && !addedAddressTaken) {
+            addedAddressTaken = true;
+            for (Function *callee : addressTaken) {
+                if (!callee->isDeclaration() && needed.insert(callee).second)
+                    worklist.push_back(callee);
+            }
+        }
+    }
+
+    unsigned numDeleted = 0;
+    for (Function &F : M) {
+        if (F.isDeclaration())
+            continue;
+        if (needed.count(&F) > 0) {
+            if (M.materialize(&F))
+                return false;
+        } else {
+            F.deleteBody();
+            numDeleted++;
+        }
+    }
+    errs() << "Materialized " << needed.size() << " functions, skipped " << numDeleted << "\n";
+    return true;
+}
+
+// File in 'SummaryDir' keeping the summaries of the module read from 'filename'.
+static std::string getSummaryPath(const std::string &filename)
+{
+    std::string name = filename;
+    std::replace(name.begin(), name.end(), '/', '_');
+    SmallString<128> path(SummaryDir);
+    sys::path::append(path, name + ".summary");
+    return path.str();
+}
+
+// Analyze the modules of a project one at a time, instead of linking them into one module first.
+// Modules are analyzed after the modules defining the functions they call, whose summaries are
+// instantiated at calls to their declarations. Only modules that call each other (directly or
+// not) are linked together, so at most one such group of modules is in memory at a time.
+static int analyzeModules(const char *argv0, const std::vector<std::string> &filenames)
+{
+    ModuleSummaries summaries;
+
+    // Summaries kept by earlier runs, e.g. of libraries not analyzed again.
+    if (!SummaryDir.empty()) {
+        sys::fs::create_directories(SummaryDir);
+        std::error_code EC;
+        for (sys::fs::directory_iterator I(SummaryDir, EC), E; I != E && !EC; I.increment(EC)) {
+            if (sys::path::extension(I->path()) == ".summary" && !summaries.read(I->path()))
+                errs() << "Ignoring corrupted summaries in " << I->path() << "\n";
+        }
+    }
+
+    // Read only the symbol tables first: which functions each module defines and declares.
+    unsigned numModules = filenames.size();
+    std::vector<std::vector<std::string>> defined(numModules), declared(numModules);
+    std::map<std::string, unsigned> definedIn;
+    for (unsigned i = 0; i < numModules; i++) {
+        LLVMContext Context;
+        std::unique_ptr<Module> M = readModule(filenames[i], Context);
+        if (M == nullptr) {
+            std::cerr << argv0 << ": bytecode of " << filenames[i] << " didn't read correctly.\n";
+            return 1;
+        }
+        for (Function &F : *M) {
+            if (!F.isDeclaration() && !F.hasLocalLinkage()) {
+                defined[i].push_back(F.getName());
+                definedIn.insert(std::make_pair(F.getName().str(), i));
+            } else if (F.isDeclaration() && !F.isIntrinsic()) {
+                declared[i].push_back(F.getName());
+            }
+        }
+    }
+
+    std::vector<std::set<unsigned>> callees(numModules);
+    std::set<std::string> calledFromOtherModules;
+    for (unsigned i = 0; i < numModules; i++) {
+        for (const auto &name : declared[i]) {
+            auto ite = definedIn.find(name);
+            if (ite != definedIn.end() && ite->second != i) {
+                callees[i].insert(ite->second);
+                calledFromOtherModules.insert(name);
+            }
+        }
+    }
+
+    // Tarjan's algorithm finishes the groups of modules calling each other callees first.
+    std::vector<std::vector<unsigned>> groups;
+    std::vector<int> index(numModules, -1), lowlink(numModules, 0);
+    std::vector<char> onStack(numModules, false);
+    std::vector<unsigned> stack;
+    int counter = 0;
+    std::function<void(unsigned)> connect = [&](unsigned v) {
+        index[v] = lowlink[v] = counter++;
+        stack.push_back(v);
+        onStack[v] = true;
+        for (unsigned w : callees[v]) {
+            if (index[w] < 0) {
+                connect(w);
+                lowlink[v] = std::min(lowlink[v], lowlink[w]);
+            } else if (onStack[w]) {
+                lowlink[v] = std::min(lowlink[v], index[w]);
+            }
+        }
+        if (lowlink[v] == index[v]) {
+            std::vector<unsigned> group;
+            unsigned w;
+            do {
+                w = stack.back();
+                stack.pop_back();
+                onStack[w] = false;
+                group.push_back(w);
+            } while (w != v);
+            std::sort(group.begin(), group.end());
+            groups.push_back(group);
+        }
+    };
+    for (unsigned i = 0; i < numModules; i++) {
+        if (index[i] < 0)
+            connect(i);
+    }
+
+    for (const auto &group : groups) {
+        LLVMContext Context;
+        std::unique_ptr<Module> M;
+        for (unsigned i : group) {
+            std::unique_ptr<Module> Src = readModule(filenames[i], Context);
+            // Declarations are relevant iff the modules analyzed before summarized them, definitions
+            // iff other modules call them.
+            if (Src != nullptr && LazyMaterialize
+                && !materializeLazily(*Src, [&](Function *F) {
+                    if (F->isDeclaration())
+                        return summaries.contains(F->getName());
+                    return calledFromOtherModules.count(F->getName()) > 0;
+                }))
+                Src = nullptr;
+            if (Src != nullptr && Src->materializeAllPermanently())
+                Src = nullptr;
+            if (Src == nullptr) {
+                std::cerr << argv0 << ": bytecode of " << filenames[i] << " didn't read correctly.\n";
+                return 1;
+            }
+            errs() << "Module " << filenames[i] << "\n";
+            if (M == nullptr) {
+                M = std::move(Src);
+            } else if (Linker::LinkModules(M.get(), Src.get())) {
+                std::cerr << argv0 << ": " << filenames[i] << " can not be linked with the modules it calls.\n";
+                return 1;
+            }
+        }
+
+        analyzeModule(*M, &summaries);
+
+        // The resolved summaries refer to the module.
+        summaries.forgetResolved();
+        M.reset();
+
+        if (!SummaryDir.empty()) {
+            for (unsigned i : group) {
+                if (!summaries.write(getSummaryPath(filenames[i]), defined[i]))
+                    errs() << "Summaries of " << filenames[i] << " can not be written\n";
+            }
+        }
+    }
+    return 0;
+}
+
+// Write the profile to 'path' with 'write', e.g. Profiler::writeJSON.
+static bool writeProfile(const std::string &path, void (Profiler::*write)(raw_ostream &))
+{
+    std::error_code EC;
+    raw_fd_ostream OS(path, EC, sys::fs::F_Text);
+    if (EC) {
+        errs() << "Can not write the profile " << path << ": " << EC.message() << "\n";
+        return false;
+    }
+    (Profiler::get().*write)(OS);
+    OS.close();
+    if (OS.has_error()) {
+        OS.clear_error();
+        errs() << "Can not write the profile " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    MemoryEffectAnalysis a;
+    // FIXME: add -disable-dsa-stdlib option by default
+    cl::ParseCommandLineOptions(argc, argv, " llvm system compiler\n");
+    sys::PrintStackTraceOnErrorSignal();
+
+    std::vector<std::string> InputFiles(InputFilenames.begin(), InputFilenames.end());
+    if (!InputList.empty()) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> ListOrErr = MemoryBuffer::getFile(InputList);
+        if (!ListOrErr) {
+            std::cerr << argv[0] << ": can not read " << InputList << ": "
+                      << ListOrErr.getError().message() << "\n";
+            return 1;
+        }
+        SmallVector<StringRef, 16> lines;
+        (*ListOrErr)->getBuffer().split(lines, "\n", -1, false);
+        for (StringRef line : lines)
+            InputFiles.push_back(line);
+    }
+    if (InputFiles.empty())
+        InputFiles.push_back("-");
+
+    if (!ProfileOutput.empty())
+        Profiler::get().enable();
+
+    if (InputFiles.size() > 1 || !SummaryDir.empty()) {
+        int ret = analyzeModules(argv[0], InputFiles);
+        if (ret != 0)
+            return ret;
+    } else {
+        const std::string &InputFilename = InputFiles[0];
+
+        // Load the module to be compiled...
+        std::string ErrorMessage;
+        std::unique_ptr<Module> M;
+        LLVMContext &Context = getGlobalContext();
+
+        // Use the bitcode streaming interface
+        DataStreamer *Streamer = getDataFileStreamer(InputFilename, &ErrorMessage);
+        if (Streamer) {
+            std::string DisplayFilename;
+            if (InputFilename == "-")
+                DisplayFilename = "<stdin>";
+            else
+                DisplayFilename = InputFilename;
+            ErrorOr<std::unique_ptr<Module>> MOrErr =
+                getStreamedBitcodeModule(DisplayFilename, Streamer, Context);
+            M = std::move(*MOrErr);
+            // Unless the module is a whole program, functions it exports may be called by code
+            // that allocates.
+            Function *Main = M != nullptr ? M->getFunction("main") : nullptr;
+            bool wholeProgram = Main != nullptr && !Main->isDeclaration();
+            if (M != nullptr && LazyMaterialize
+                && !materializeLazily(*M, [&](Function *F) {
+                    return !wholeProgram && !F->isDeclaration() && !F->hasLocalLinkage();
+                }))
+                M = nullptr;
+            if (M != nullptr && M->materializeAllPermanently())
+                M = nullptr;
+        }
+
+        if (M == nullptr) {
+            std::cerr << argv[0] << ": bytecode didn't read correctly.\n";
+            return 1;
+        }
+
+        analyzeModule(*M, nullptr);
+    }
+
+    if (!ProfileOutput.empty()) {
+        if (!writeProfile(ProfileOutput + ".json", &Profiler::writeJSON) ||
+            !writeProfile(ProfileOutput + ".trace.json", &Profiler::writeChromeTrace))
+            return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,26 @@
+// Run with -flowuni-field-sensitive: the fields at distinct offsets of 's' and 't' are told apart.
+#include "FCPAnnotation.h"
+
+struct S {
+  int *a;
+  int *b;
+};
+
+int main(int argc, char **argv) {
+  int x, y, z;
+  struct S s, t;
+  struct S *p = &s;
+  s.a = &x;
+  s.b = &y;
+  t.a = &x;
+  t.b = &z;
+  __may_pointTo_exactly(s.a, &x);
+  __may_pointTo_exactly(s.b, &y);
+  if(argc) {
+    p = &t;
+  }
+  // 's' and 't' are merged, but their fields stay apart by offset.
+  __may_pointTo_exactly(p->b, &y, &z);
+  __may_pointTo_exactly(p->a, &x);
+  return 0;
+}
@@ -0,0 +1,33 @@
+#include <string.h>
+#include "FCPAnnotation.h"
+
+int a, b;
+char buf[16];
+static int* (*fp)(void);
+
+int* ga(void) {
+  return &a;
+}
+
+int* gb(void) {
+  return &b;
+}
+
+void set(int c) {
+  if(c) {
+    fp = ga;
+  } else {
+    fp = gb;
+  }
+}
+
+int main(int argc, char **argv) {
+  set(argc);
+  // Both targets DSA finds for the call through 'fp' are merged.
+  __may_pointTo_exactly(fp(), &a, &b);
+  // A callee cast to another type is still called directly.
+  __may_pointTo_exactly(((int* (*)(int))ga)(3), &a);
+  // strchr is only declared: its result aliases its first argument.
+  __may_pointTo_exactly(strchr(buf, 'x'), &buf);
+  return 0;
+}
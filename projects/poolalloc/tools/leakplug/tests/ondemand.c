@@ -0,0 +1,32 @@
+// Run with and without -flowuni-on-demand: both must report the same results, although the
+// on-demand run never analyzes 'unqueried'.
+#include "FCPAnnotation.h"
+
+int a, b;
+
+int* geta(void) {
+  return &a;
+}
+
+int* pick(int c) {
+  int *r = &b;
+  if(c) {
+    r = geta();
+  }
+  return r;
+}
+
+int* unqueried(int c) {
+  return pick(c);
+}
+
+int main(int argc, char **argv) {
+  int x, y;
+  int *p = &x;
+  if(argc) {
+    p = &y;
+  }
+  __may_pointTo_exactly(p, &x, &y);
+  __may_pointTo_exactly(pick(argc), &a, &b);
+  return 0;
+}
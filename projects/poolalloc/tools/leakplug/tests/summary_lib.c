@@ -0,0 +1,13 @@
+// Exports summaries to the callers in summary_use.c.
+int a, b;
+
+int* geta(void) {
+  return &a;
+}
+
+int* pick(int c) {
+  if(c) {
+    return &a;
+  }
+  return &b;
+}
@@ -0,0 +1,15 @@
+// Analyze one module at a time, after summary_lib.c:
+//   leakplug -summary-dir=<dir> summary_lib.bc summary_use.bc
+// The calls are resolved against the summaries summary_lib.bc exports. Without them, the
+// declarations return unknown memory and both assertions fail.
+#include "FCPAnnotation.h"
+
+extern int a, b;
+int* geta(void);
+int* pick(int c);
+
+int main(int argc, char **argv) {
+  __may_pointTo_exactly(geta(), &a);
+  __may_pointTo_exactly(pick(argc), &a, &b);
+  return 0;
+}